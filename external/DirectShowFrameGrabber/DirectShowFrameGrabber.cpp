@@ -525,10 +525,9 @@ void DirectShowFrameGrabber::getFrame(cv::Mat &img){
 	  while (is_image_arrived_ == false) {
         m_cv.wait(lk);  // ϐavailւ̒ʒmҋ@
       }
-	  img = m_buffer_img.clone();
+	  cv::flip(m_buffer_img, img, 0);// flip image straight into the caller's buffer
 	  is_image_arrived_ = false;
 	}
-	cv::flip(img, img, 0);// flip image
 }
 
 //void DirectShowFrameGrabber::handleFrame( Measurement::Timestamp utTime, const Vision::Image& bufferImage )
@@ -552,7 +551,7 @@ void DirectShowFrameGrabber::handleFrame( const cv::Mat& bufferImage )
 
 	{
 		std::lock_guard<std::mutex> lk(m_mutex);
-		m_buffer_img = bufferImage.clone();
+		bufferImage.copyTo(m_buffer_img); // reuses the buffer once its size is known
 		is_image_arrived_ = true;
 	}
 	m_cv.notify_one();
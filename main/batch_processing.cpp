@@ -0,0 +1,166 @@
+#include "batch_processing.h"
+
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <boost/filesystem.hpp>
+#include "raw_video.h"
+#include "image_sequence_camera.h"
+#include "frame_parallel.h"
+#include "task_scheduler.h"
+
+namespace eye_tracker
+{
+namespace fs = boost::filesystem;
+
+std::unique_ptr<EyeCameraParent> open_recording(const std::string &file){
+	const fs::path path(file);
+	const std::string ext = path.extension().string();
+	if (fs::is_directory(path)){
+		// The batch already runs one recording per core, so a single decoder thread per sequence
+		return std::make_unique<EyeCameraImageSequence>(file, "", ".png", 1);
+	}
+	if (ext == kRawVideoExtension){
+		return std::make_unique<EyeCameraRaw>(file);
+	}
+	if (ext == ".avi" || ext == ".mp4" || ext == ".wmv"){
+		return std::make_unique<EyeCamera>(file, false);
+	}
+	throw "open_recording: not a video, raw eye video or image sequence";
+}
+
+namespace {
+void write_header(std::ostream &os){
+	os << "sequence,pupil_found,ellipse_cx,ellipse_cy,ellipse_width,ellipse_height,ellipse_angle,"
+		<< "model_built,eye_x,eye_y,eye_z,eye_radius,pupil_x,pupil_y,pupil_z,pupil_radius,gaze_x,gaze_y,gaze_z,reliability,is_reliable\n";
+}
+
+void write_row(std::ostream &os, const TrackedFrame &t){
+	const GazeSample &s = t.sample;
+	const cv::RotatedRect &rr = t.detection.rect; // Undistorted image coordinates
+	os << s.frame.sequence << "," << s.is_pupil_found << ",";
+	if (s.is_pupil_found){
+		os << rr.center.x << "," << rr.center.y << "," << rr.size.width << "," << rr.size.height << "," << rr.angle << ",";
+	}
+	else{
+		os << ",,,,,";
+	}
+	os << s.is_model_built << ",";
+	if (s.eye){
+		os << s.eye.centre.x() << "," << s.eye.centre.y() << "," << s.eye.centre.z() << "," << s.eye.radius << ",";
+	}
+	else{
+		os << ",,,,";
+	}
+	if (s.pupil_circle){
+		const Eigen::Vector3d gaze = s.pupil_circle.normal.normalized();
+		os << s.pupil_circle.centre.x() << "," << s.pupil_circle.centre.y() << "," << s.pupil_circle.centre.z() << ","
+			<< s.pupil_circle.radius << "," << gaze.x() << "," << gaze.y() << "," << gaze.z() << ",";
+	}
+	else{
+		os << ",,,,,,,";
+	}
+	os << s.reliability << "," << s.is_reliable << "\n";
+}
+}
+
+BatchResult track_recording(const std::string &input, const std::string &output, const BatchOptions &options){
+	BatchResult result;
+	result.input = input;
+	result.output = output;
+	const Clock::time_point start = Clock::now();
+	try{
+		std::unique_ptr<EyeCameraParent> source = open_recording(input);
+		source->setPixelFormat(PixelFormat::Y8);
+
+		const double focal_length = (options.K.at<double>(0, 0) + options.K.at<double>(1, 1)) * 0.5;
+		CameraTracker tracker(std::make_unique<CameraUndistorter>(options.K, options.distCoeffs),
+			std::make_unique<EyeModelUpdater>(focal_length, 5, 0.5), options.tracking);
+		tracker.undistorter().setFixedPointMaps(true);
+
+		std::ofstream ofs(output);
+		if (ofs.is_open() == false){
+			throw "track_recording: output file open error";
+		}
+		ofs << std::setprecision(7);
+		write_header(ofs);
+
+		auto write = [&](const TrackedFrame &t) {
+			write_row(ofs, t);
+			result.frames++;
+			if (t.sample.is_pupil_found) result.pupils++;
+			if (t.sample.pupil_circle) result.gazes++;
+		};
+
+		// Build the eye model frame by frame, since every observation depends on the ones before
+		TrackedFrame tracked;
+		bool is_eos = false;
+		while (options.frame_threads <= 1 || tracker.updater().is_model_built() == false){
+			source->fetchFrame(tracked.frame);
+			if (tracked.frame.empty()){
+				is_eos = true;
+				break;
+			}
+			tracker.process(tracked);
+			write(tracked);
+		}
+		// The remaining frames only read the model and are independent of each other
+		if (is_eos == false){
+			FrameParallelStatistics stats = track_frames_parallel(*source, tracker, options.frame_threads, write);
+			std::cout << input << ": " << stats.frames << " frames tracked " << options.frame_threads << " at a time in "
+				<< stats.blocks << " blocks" << std::endl;
+		}
+		result.is_ok = ofs.good();
+	}
+	catch (const char *c){
+		std::cout << input << ": " << c << std::endl;
+	}
+	catch (const std::exception &e){
+		std::cout << input << ": " << e.what() << std::endl;
+	}
+	result.seconds = millisecondsSince(start) / 1000.0;
+	return result;
+}
+
+std::vector<BatchResult> run_batch(const std::vector<std::string> &inputs, const BatchOptions &options){
+	std::vector<BatchResult> results(inputs.size());
+	TaskScheduler &scheduler = TaskScheduler::shared();
+	int threads = options.threads > 0 ? options.threads : static_cast<int>(scheduler.workers() + 1);
+	if (threads > static_cast<int>(inputs.size())) threads = static_cast<int>(inputs.size());
+	if (threads < 1) threads = 1;
+	std::cout << "run_batch: " << inputs.size() << " recordings on " << threads << " threads" << std::endl;
+
+	// Cores not taken by a recording of their own track the frames of the recordings in parallel.
+	// Both levels run on the shared scheduler, so idle workers help whichever recording has frames left
+	BatchOptions recording_options = options;
+	if (recording_options.frame_threads <= 0){
+		const int cores = static_cast<int>(scheduler.workers() + 1);
+		recording_options.frame_threads = (cores > threads) ? cores / threads : 1;
+	}
+
+	// Parallelism comes from the recordings and frames; OpenCV's own worker threads would only compete with them
+	const int cv_threads = cv::getNumThreads();
+	if (threads > 1 || recording_options.frame_threads > 1) cv::setNumThreads(1);
+
+	const Clock::time_point start = Clock::now();
+	scheduler.parallel_for(inputs.size(), [&](size_t i) {
+		fs::path output_path(options.output_directory.empty() ? fs::path(inputs[i]).parent_path() : fs::path(options.output_directory));
+		output_path /= fs::path(inputs[i]).stem().string() + options.output_suffix;
+		results[i] = track_recording(inputs[i], output_path.string(), recording_options);
+	}, threads);
+	const double seconds = millisecondsSince(start) / 1000.0;
+	cv::setNumThreads(cv_threads);
+
+	size_t frames = 0, failed = 0;
+	for (const BatchResult &r : results){
+		std::cout << "  " << r.input << " -> " << r.output << ": " << (r.is_ok ? "" : "FAILED, ") << r.frames << " frames, "
+			<< r.pupils << " pupils, " << r.gazes << " gazes, " << (r.seconds > 0 ? r.frames / r.seconds : 0) << " fps" << std::endl;
+		frames += r.frames;
+		if (r.is_ok == false) failed++;
+	}
+	std::cout << "run_batch: " << frames << " frames in " << seconds << " s, " << (seconds > 0 ? frames / seconds : 0)
+		<< " fps in total, " << failed << " failed" << std::endl;
+	return results;
+}
+
+} // namespace
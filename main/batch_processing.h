@@ -0,0 +1,56 @@
+#ifndef BATCH_PROCESSING_H
+#define BATCH_PROCESSING_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <opencv2/core/core.hpp>
+#include "eye_cameras.h"
+#include "camera_tracker.h"
+
+namespace eye_tracker
+{
+
+/// Settings of a headless batch run
+struct BatchOptions {
+	cv::Mat K;                              ///< Camera intrinsic matrix
+	cv::Vec<double, 8> distCoeffs;          ///< Lens distortion (k1 k2 p1 p2 [k3 [k4 k5 k6]])
+	TrackingOptions tracking;               ///< Tracking steps of every recording
+	int threads = 0;                        ///< Recordings processed at the same time, 0 for one per core
+	int frame_threads = 0;                  ///< Threads tracking the frames of one recording once its eye model is built, 0 for the cores left over per recording
+	std::string output_directory;           ///< Where the results go; empty for next to each recording
+	std::string output_suffix = ".gaze.csv"; ///< Result file name: <recording stem><suffix>
+};
+
+/// Outcome of one recording of a batch run
+struct BatchResult {
+	std::string input;
+	std::string output;
+	bool is_ok = false;
+	size_t frames = 0;
+	size_t pupils = 0;  ///< Frames with a 2D pupil
+	size_t gazes = 0;   ///< Frames with a 3D gaze
+	double seconds = 0; ///< Processing time of the recording
+};
+
+/// Opens a recording as an image source: a video, a raw eye video (.eyeraw) or an image sequence directory.
+/// Throws a const char* if it cannot be opened
+std::unique_ptr<EyeCameraParent> open_recording(const std::string &file);
+
+/**
+Tracks one recording without any display and writes one CSV line per frame:
+2D pupil ellipse, 3D eye centre and radius, 3D pupil centre and radius, gaze vector and reliability.
+The eye model is built frame by frame; with options.frame_threads > 1 the frames after that are
+tracked in parallel (see track_frames_parallel).
+*/
+BatchResult track_recording(const std::string &input, const std::string &output, const BatchOptions &options);
+
+/**
+Tracks many recordings in parallel on the shared TaskScheduler, one tracker per recording and
+up to options.threads recordings at a time, and prints the per-recording and aggregate frame rates.
+@return the results in the order of the inputs
+*/
+std::vector<BatchResult> run_batch(const std::vector<std::string> &inputs, const BatchOptions &options);
+
+} // namespace
+#endif // BATCH_PROCESSING_H
@@ -0,0 +1,139 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace eye_tracker
+{
+
+/// Counters of a BoundedQueue
+struct QueueStatistics {
+	size_t capacity = 0;
+	size_t size = 0;        ///< Items waiting now
+	size_t peak = 0;        ///< Highest number of items that waited at once
+	size_t pushed = 0;
+	size_t popped = 0;
+	size_t full_waits = 0;  ///< push() calls that had to wait for space
+	size_t empty_waits = 0; ///< pop() calls that had to wait for an item
+};
+
+/**
+* @class BoundedQueue
+* @brief Blocking FIFO queue of limited capacity between threads.
+*
+* push() waits while the queue is full, pop() while it is empty. close() ends
+* the stream: pending pushes fail, and pop() returns the remaining items and
+* then false. Items are moved in and out, never copied.
+*/
+template<typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity)
+		: capacity_(capacity < 1 ? 1 : capacity)
+	{
+	}
+
+	/// Appends an item, waiting for space. Returns false if the queue was closed
+	bool push(T &&item) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (is_closed_ == false && items_.size() >= capacity_) {
+			stats_.full_waits++;
+			not_full_cv_.wait(lock, [this]{ return is_closed_ || items_.size() < capacity_; });
+		}
+		if (is_closed_) return false;
+		items_.push_back(std::move(item));
+		stats_.pushed++;
+		if (items_.size() > stats_.peak) stats_.peak = items_.size();
+		lock.unlock();
+		not_empty_cv_.notify_one();
+		return true;
+	}
+
+	/// Appends an item if there is space, without waiting
+	bool tryPush(T &&item) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (is_closed_ || items_.size() >= capacity_) return false;
+		items_.push_back(std::move(item));
+		stats_.pushed++;
+		if (items_.size() > stats_.peak) stats_.peak = items_.size();
+		lock.unlock();
+		not_empty_cv_.notify_one();
+		return true;
+	}
+
+	/// Takes the oldest item, waiting for one. Returns false once the queue is closed and empty
+	bool pop(T &item) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (items_.empty() && is_closed_ == false) {
+			stats_.empty_waits++;
+			not_empty_cv_.wait(lock, [this]{ return is_closed_ || items_.empty() == false; });
+		}
+		if (items_.empty()) return false;
+		item = std::move(items_.front());
+		items_.pop_front();
+		stats_.popped++;
+		lock.unlock();
+		not_full_cv_.notify_one();
+		return true;
+	}
+
+	/// Takes the oldest item if there is one, without waiting
+	bool tryPop(T &item) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (items_.empty()) return false;
+		item = std::move(items_.front());
+		items_.pop_front();
+		stats_.popped++;
+		lock.unlock();
+		not_full_cv_.notify_one();
+		return true;
+	}
+
+	/// Ends the stream and wakes all waiting threads
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			is_closed_ = true;
+		}
+		not_full_cv_.notify_all();
+		not_empty_cv_.notify_all();
+	}
+
+	bool isClosed() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return is_closed_;
+	}
+	size_t size() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return items_.size();
+	}
+	size_t capacity() const { return capacity_; }
+
+	QueueStatistics statistics() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		QueueStatistics stats = stats_;
+		stats.capacity = capacity_;
+		stats.size = items_.size();
+		return stats;
+	}
+
+private:
+	const size_t capacity_;
+	std::deque<T> items_;
+	bool is_closed_ = false;
+	QueueStatistics stats_;
+	mutable std::mutex mutex_;
+	std::condition_variable not_full_cv_;
+	std::condition_variable not_empty_cv_;
+
+	// Prevent copying
+	BoundedQueue(const BoundedQueue& other);
+	BoundedQueue& operator=(const BoundedQueue& rhs);
+};
+
+} // namespace
+#endif // BOUNDED_QUEUE_H
@@ -0,0 +1,186 @@
+#include "camera_tracker.h"
+
+#include <string>
+#include <algorithm>
+#include <iostream>
+#include <functional>
+#include <opencv2/imgproc/imgproc.hpp>
+
+namespace eye_tracker
+{
+
+CameraTracker::CameraTracker(std::unique_ptr<CameraUndistorter> undistorter, std::unique_ptr<EyeModelUpdater> updater,
+	const TrackingOptions &options)
+	: options_(options), undistorter_(std::move(undistorter)), updater_(std::move(updater)),
+	is_reset_requested_(false), more_observations_(0)
+{
+	pupil_fitter_.setDebug(false);
+	pupil_fitter_.setTemporalTracking(options_.is_temporal_tracking);
+	pupil_fitter_.setCoarseToFine(options_.is_coarse_to_fine);
+}
+
+void CameraTracker::preprocess(TrackedFrame &t){
+	const Frame &frame = t.frame;
+	undistorter_->prepare(frame.image.size());
+	t.is_undistorted = false;
+	if (options_.undistort_mode == UndistortMode::FULL_FRAME) {
+		if (frame.info.format == PixelFormat::Y8) {
+			undistorter_->undistort(frame, t.grey);
+			t.is_undistorted = true;
+		}
+		else {
+			// Remap and color conversion in one pass
+			undistorter_->undistortGray(frame, t.grey);
+		}
+	}
+	else if (frame.info.format == PixelFormat::Y8) {
+		t.grey = frame;
+	}
+	else {
+		cv::cvtColor(frame.image, t.grey.image, CV_RGB2GRAY);
+		t.grey.info = frame.info;
+		t.grey.info.format = PixelFormat::Y8;
+	}
+}
+
+void CameraTracker::detect(TrackedFrame &t, PupilFitterWorkspace &ws){
+	PupilDetection &detection = t.detection;
+	pupil_fitter_.pupilAreaFitRR(static_cast<const Frame&>(t.grey), ws, detection);
+	if (options_.undistort_mode == UndistortMode::POINTS && detection.is_found) {
+		detection.is_found = undistorter_->undistortEllipse(t.frame.image.size(), detection.rect, detection.inliers);
+	}
+}
+
+void CameraTracker::estimate(TrackedFrame &t){
+	if (is_reset_requested_.exchange(false)) {
+		updater_->reset();
+	}
+	const int more = more_observations_.exchange(0);
+	if (more > 0) {
+		updater_->add_fitter_max_count(more);
+	}
+
+	// Image stored with new model observations
+	cv::Mat observation_img = t.grey.image;
+	if (options_.undistort_mode == UndistortMode::POINTS && t.detection.is_found && updater_->is_model_built() == false) {
+		// Only the area around the pupil is needed for the contrast refinement of the model
+		const float kRoiScale = options_.roi_scale;
+		cv::Rect roi = t.detection.rect.boundingRect();
+		roi -= cv::Point(cvRound(roi.width * (kRoiScale - 1) / 2), cvRound(roi.height * (kRoiScale - 1) / 2));
+		roi += cv::Size(cvRound(roi.width * (kRoiScale - 1)), cvRound(roi.height * (kRoiScale - 1)));
+		cv::Mat roi_img;
+		undistorter_->undistortRoi(t.grey.image, roi, roi_img);
+		observation_img = roi_img;
+	}
+
+	singleeyefitter::Ellipse2D<double> el = singleeyefitter::toEllipse<double>(toImgCoordInv(t.detection.rect, t.frame.image, 1.0));
+	const bool force_add = false;
+	t.sample = updater_->update(t.detection.frame, observation_img, t.detection.is_found, el, t.detection.inliers,
+		options_.reliability_threshold, force_add);
+	t.fitter_count = updater_->fitter_count();
+	t.fitter_end_count = updater_->fitter_end_count();
+}
+
+void CameraTracker::processWithModel(TrackedFrame &t, PupilFitterWorkspace &ws){
+	preprocess(t);
+	detect(t, ws);
+	singleeyefitter::Ellipse2D<double> el = singleeyefitter::toEllipse<double>(toImgCoordInv(t.detection.rect, t.frame.image, 1.0));
+	t.sample = updater_->estimate(t.detection.frame, t.grey.image, t.detection.is_found, el, t.detection.inliers,
+		options_.reliability_threshold);
+	t.fitter_count = updater_->fitter_count();
+	t.fitter_end_count = updater_->fitter_end_count();
+}
+
+void CameraTracker::render(const TrackedFrame &t, cv::Mat &img_rgb_debug, bool with_model_status){
+	// Results are in undistorted coordinates, so is the displayed image
+	cv::Mat img_display;
+	if (t.is_undistorted) {
+		img_display = t.grey.image;
+	}
+	else {
+		undistorter_->undistort(t.frame.image, img_display);
+	}
+	if (img_display.channels() == 1) {
+		cv::cvtColor(img_display, img_rgb_debug, CV_GRAY2BGR);
+	}
+	else {
+		img_display.copyTo(img_rgb_debug); // Reuses the buffer of the previous call
+	}
+
+	const GazeSample &sample = t.sample;
+	// 2D pupil
+	if (sample.is_pupil_found) {
+		cv::ellipse(img_rgb_debug, t.detection.rect, cv::Vec3b(255, 128, 0), 1);
+	}
+
+	// 3D eye ball
+	if (sample.is_model_built) {
+		cv::putText(img_rgb_debug, "Reliability: " + std::to_string(sample.reliability), cv::Point(30, 440), cv::FONT_HERSHEY_SIMPLEX, 1.0, cv::Scalar(0, 128, 255), 1);
+		if (sample.is_reliable) {
+			updater_->render(img_rgb_debug, sample);
+		}
+	}
+	else {
+		if (with_model_status) {
+			updater_->render_status(img_rgb_debug);
+		}
+		cv::putText(img_rgb_debug, "Sample #: " + std::to_string(t.fitter_count) + "/" + std::to_string(t.fitter_end_count),
+			cv::Point(30, 440), cv::FONT_HERSHEY_SIMPLEX, 1.0, cv::Scalar(0, 128, 255), 2);
+	}
+}
+
+void benchmark_pupil_localisation(const std::vector<cv::Mat> &images, const std::vector<cv::Point2f> &pupil_centers, int iterations)
+{
+	PupilFitter fitter;
+	fitter.setParameters();
+	PupilFitterWorkspace ws;
+
+	struct Path {
+		std::string name;
+		std::function<cv::Point(const cv::Mat&)> run;
+	};
+	std::vector<Path> paths = {
+		{ "sampled 7x7 lattice, 10 px grid", [&](const cv::Mat &img) { return fitter.locateDarkAreaSampled(img); } },
+		{ "integral image, dense 4 px grid", [&](const cv::Mat &img) { return fitter.locateDarkArea(img, ws); } },
+	};
+
+	std::cout << "Pupil localisation benchmark: " << images.size() << " images, " << iterations << " iterations" << std::endl;
+	std::vector<cv::Point> reference;
+	for (auto &path : paths) {
+		std::vector<cv::Point> found;
+		for (const cv::Mat &img : images) {
+			found.push_back(path.run(img)); // Warm up, grows the workspace
+		}
+		const Clock::time_point start = Clock::now();
+		for (int i = 0; i < iterations; i++) {
+			for (const cv::Mat &img : images) {
+				path.run(img);
+			}
+		}
+		const double ms = images.empty() ? 0 : millisecondsSince(start) / (iterations * images.size());
+		if (reference.empty()) {
+			reference = found;
+		}
+		double diff_sum = 0, diff_max = 0, error_sum = 0, error_max = 0;
+		for (size_t i = 0; i < found.size(); i++) {
+			const double diff = cv::norm(found[i] - reference[i]);
+			diff_sum += diff;
+			diff_max = std::max(diff_max, diff);
+			if (i < pupil_centers.size()) {
+				const double error = cv::norm(cv::Point2f(found[i]) - pupil_centers[i]);
+				error_sum += error;
+				error_max = std::max(error_max, error);
+			}
+		}
+		const size_t n = found.empty() ? 1 : found.size();
+		std::cout << "  " << path.name << ": " << ms << " ms/frame, distance to sampled mean=" << diff_sum / n
+			<< " px, max=" << diff_max << " px";
+		if (pupil_centers.empty() == false) {
+			const size_t m = std::min(found.size(), pupil_centers.size());
+			std::cout << ", to pupil centre mean=" << (m > 0 ? error_sum / m : 0) << " px, max=" << error_max << " px";
+		}
+		std::cout << std::endl;
+	}
+}
+
+} // namespace
@@ -0,0 +1,118 @@
+#ifndef CAMERA_TRACKER_H
+#define CAMERA_TRACKER_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "frame.h"
+#include "pupilFitter.h"
+#include "camera_undistorter.h"
+#include "eye_model_updater.h"
+
+namespace eye_tracker
+{
+/// Times the sampled (default) and the dense coarse pupil localisation on Y8 images and prints
+/// the time per frame of both, how far their results are apart and, if given, from the true pupil centres
+void benchmark_pupil_localisation(const std::vector<cv::Mat> &images, const std::vector<cv::Point2f> &pupil_centers, int iterations = 20);
+
+/// Settings of the tracking steps of a camera
+struct TrackingOptions {
+	UndistortMode undistort_mode = UndistortMode::POINTS;
+	double reliability_threshold = 0.8; ///< Minimum similarity of the 2D pupil and the reprojected 3D pupil
+	float roi_scale = 1.5f;             ///< Area around the pupil undistorted for new model observations (POINTS mode)
+	bool is_temporal_tracking = false;  ///< Search the 2D pupil around the previous one first, see PupilFitter::setTemporalTracking.
+	                                    ///< Frame-parallel tracking gives each workspace every n-th frame, so it predicts from older frames there
+	bool is_coarse_to_fine = false;     ///< Detect the 2D pupil of frames larger than 640x480 at 640x480 and refine it at full resolution,
+	                                    ///< see PupilFitter::setCoarseToFine
+};
+
+/**
+* @brief A frame on its way through the tracking steps, together with
+* everything computed from it so far
+*/
+struct TrackedFrame {
+	Frame frame;                  ///< Captured frame
+	Frame grey;                   ///< Single channel image the pupil is detected in
+	bool is_undistorted = false;  ///< grey is the undistorted frame and can be displayed as is
+	PupilDetection detection;     ///< 2D pupil in undistorted image coordinates
+	GazeSample sample;            ///< 3D result
+	size_t fitter_count = 0;      ///< Model observations collected when the sample was computed
+	size_t fitter_end_count = 0;  ///< Observations needed to build the model
+};
+
+/**
+* @class CameraTracker
+* @brief Tracking steps of one camera: preprocessing, 2D pupil detection and 3D gaze estimation.
+*
+* Each step works on a TrackedFrame in place, so the steps can be called one
+* after the other or run as stages of a Pipeline. Every step keeps its own
+* state (the undistorter is prepared for the frame size in preprocess() and
+* only read afterwards, the detector belongs to detect(), the eye model to
+* estimate()), so the three steps may run on three threads as long as each
+* one is called from a single thread and the frame size does not change.
+* Model commands from the UI are queued and applied by the next estimate().
+*/
+class CameraTracker
+{
+public:
+	CameraTracker(std::unique_ptr<CameraUndistorter> undistorter, std::unique_ptr<EyeModelUpdater> updater,
+		const TrackingOptions &options = TrackingOptions());
+
+	/// Converts the frame to a single channel image, undistorted in FULL_FRAME mode
+	void preprocess(TrackedFrame &t);
+	/// Detects the 2D pupil; in POINTS mode only the ellipse and its edge points are undistorted
+	void detect(TrackedFrame &t) { detect(t, pupil_workspace_); }
+	/// detect() with the detector scratch state of the calling thread
+	void detect(TrackedFrame &t, PupilFitterWorkspace &ws);
+	/// Adds the pupil to the eye model, or unprojects it to a 3D gaze once the model is built
+	void estimate(TrackedFrame &t);
+	/// Runs all steps
+	void process(TrackedFrame &t) {
+		preprocess(t);
+		detect(t);
+		estimate(t);
+	}
+
+	/**
+	Runs all steps with the built eye model, without changing any state of the tracker.
+	Several threads may call this at the same time, each with its own workspace, as long as
+	no thread calls estimate() meanwhile. Frames must have the size of the frames before.
+	*/
+	void processWithModel(TrackedFrame &t, PupilFitterWorkspace &ws);
+
+	/// Resets the eye model before the next estimate(). Thread-safe
+	void requestReset() { is_reset_requested_ = true; }
+	/// Collects n more observations and rebuilds the model before the next estimate(). Thread-safe
+	void requestMoreObservations(int n) { more_observations_ += n; }
+
+	/**
+	Draws the undistorted frame and the results into a color image.
+	@param t a tracked frame that went through all steps
+	@param img_rgb_debug output image
+	@param with_model_status also draw the observations of the model being built. This reads the
+	model, so only set it on the thread that calls estimate()
+	*/
+	void render(const TrackedFrame &t, cv::Mat &img_rgb_debug, bool with_model_status = false);
+
+	CameraUndistorter& undistorter() { return *undistorter_; }
+	EyeModelUpdater& updater() { return *updater_; }
+	const TrackingOptions& options() const { return options_; }
+
+protected:
+	const TrackingOptions options_;
+	std::unique_ptr<CameraUndistorter> undistorter_;
+	std::unique_ptr<EyeModelUpdater> updater_;
+	PupilFitter pupil_fitter_;
+	PupilFitterWorkspace pupil_workspace_; // Scratch state of detect()
+
+	std::atomic<bool> is_reset_requested_;
+	std::atomic<int> more_observations_;
+private:
+	// Prevent copying
+	CameraTracker(const CameraTracker& other);
+	CameraTracker& operator=(const CameraTracker& rhs);
+};
+
+} // namespace
+#endif // CAMERA_TRACKER_H
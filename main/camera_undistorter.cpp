@@ -0,0 +1,247 @@
+#include "camera_undistorter.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace eye_tracker
+{
+
+CameraUndistorter::CameraUndistorter(const cv::Mat &K, const cv::Vec<double, 8> &distCoeffs)
+	: K0_(K.clone()), distCoeffs_(distCoeffs)
+{
+	std::cout << "Intrinsic (matrix): " << K0_ << std::endl;
+	std::cout << "Intrinsic (distortion): " << distCoeffs_ << std::endl;
+
+	// Weights of the 4 neighbours for every sub-pixel position of a fixed-point map
+	weights_.resize(cv::INTER_TAB_SIZE * cv::INTER_TAB_SIZE);
+	for (int fy = 0; fy < cv::INTER_TAB_SIZE; fy++) {
+		for (int fx = 0; fx < cv::INTER_TAB_SIZE; fx++) {
+			const double ax = static_cast<double>(fx) / cv::INTER_TAB_SIZE;
+			const double ay = static_cast<double>(fy) / cv::INTER_TAB_SIZE;
+			const double scale = 1 << kWeightBits;
+			cv::Vec4i &w = weights_[fy * cv::INTER_TAB_SIZE + fx];
+			w[0] = cvRound((1 - ax) * (1 - ay) * scale);
+			w[1] = cvRound(ax * (1 - ay) * scale);
+			w[2] = cvRound((1 - ax) * ay * scale);
+			w[3] = (1 << kWeightBits) - w[0] - w[1] - w[2]; // Weights sum up to exactly 1
+		}
+	}
+}
+
+void CameraUndistorter::init_maps(const cv::Size &s) {
+	if (is_fixed_point_) {
+		init_fixed_point_maps(s);
+	}
+	else {
+		cv::initUndistortRectifyMap(K0_, distCoeffs_, cv::Mat(), K0_, s, CV_32FC1, mapx_, mapy_);
+	}
+}
+
+void CameraUndistorter::init_fixed_point_maps(const cv::Size &s) {
+	cv::initUndistortRectifyMap(K0_, distCoeffs_, cv::Mat(), K0_, s, CV_16SC2, map_xy_, map_a_);
+}
+
+void CameraUndistorter::init_point_lut(const cv::Size &s) {
+	// Grid nodes every kLutStep pixels, with the last node at or beyond the image border
+	const int nx = (s.width - 1 + kLutStep - 1) / kLutStep + 1;
+	const int ny = (s.height - 1 + kLutStep - 1) / kLutStep + 1;
+	cv::Mat grid(1, nx * ny, CV_32FC2);
+	cv::Vec2f *g = grid.ptr<cv::Vec2f>(0);
+	for (int y = 0; y < ny; y++) {
+		for (int x = 0; x < nx; x++) {
+			*g++ = cv::Vec2f(static_cast<float>(x * kLutStep), static_cast<float>(y * kLutStep));
+		}
+	}
+	// Iterative inverse of the distortion model, solved once per grid node
+	cv::Mat undistorted;
+	cv::undistortPoints(grid, undistorted, K0_, distCoeffs_, cv::noArray(), K0_);
+	point_lut_ = undistorted.reshape(2, ny).clone();
+	lut_image_size_ = s;
+}
+
+void CameraUndistorter::undistort(const cv::Mat &in, cv::Mat &out) {
+	prepare_maps(in.size());
+	if (is_fixed_point_) {
+		cv::remap(in, out, map_xy_, map_a_, cv::INTER_LINEAR);
+	}
+	else {
+		cv::remap(in, out, mapx_, mapy_, cv::INTER_LINEAR);
+	}
+}
+
+void CameraUndistorter::undistortGray(const cv::Mat &in, cv::Mat &out) {
+	if (in.type() == CV_8UC1) {
+		undistort(in, out);
+		return;
+	}
+	if (in.type() != CV_8UC3) {
+		throw "CameraUndistorter: undistortGray expects an 8 bit, 1 or 3 channel image";
+	}
+	prepare_fixed_point_maps(in.size());
+	out.create(in.size(), CV_8UC1);
+
+	// Same integer luma weights (B, G, R) as cv::cvtColor(CV_BGR2GRAY)
+	const int kLumaBits = 14;
+	const int kB = 1868, kG = 9617, kR = 4899;
+	const int w = in.cols;
+	const int h = in.rows;
+	for (int y = 0; y < h; y++) {
+		const cv::Vec2s *xy = map_xy_.ptr<cv::Vec2s>(y);
+		const uint16_t *a = map_a_.ptr<uint16_t>(y);
+		uchar *dst = out.ptr<uchar>(y);
+		for (int x = 0; x < w; x++) {
+			const int sx = xy[x][0];
+			const int sy = xy[x][1];
+			const cv::Vec4i &wt = weights_[a[x] & (cv::INTER_TAB_SIZE * cv::INTER_TAB_SIZE - 1)];
+			int luma[4];
+			if (sx >= 0 && sy >= 0 && sx < w - 1 && sy < h - 1) {
+				const uchar *p0 = in.ptr<uchar>(sy) + sx * 3;
+				const uchar *p1 = in.ptr<uchar>(sy + 1) + sx * 3;
+				luma[0] = p0[0] * kB + p0[1] * kG + p0[2] * kR;
+				luma[1] = p0[3] * kB + p0[4] * kG + p0[5] * kR;
+				luma[2] = p1[0] * kB + p1[1] * kG + p1[2] * kR;
+				luma[3] = p1[3] * kB + p1[4] * kG + p1[5] * kR;
+			}
+			else {
+				// Border: neighbours outside the image are black, as with cv::remap's default
+				for (int k = 0; k < 4; k++) {
+					const int nx = sx + (k & 1);
+					const int ny = sy + (k >> 1);
+					if (nx >= 0 && ny >= 0 && nx < w && ny < h) {
+						const uchar *p = in.ptr<uchar>(ny) + nx * 3;
+						luma[k] = p[0] * kB + p[1] * kG + p[2] * kR;
+					}
+					else {
+						luma[k] = 0;
+					}
+				}
+			}
+			// Interpolate in luma * 2^14 and round once; the largest sum fits into 64 bits only
+			const int64_t v = static_cast<int64_t>(luma[0]) * wt[0] + static_cast<int64_t>(luma[1]) * wt[1]
+				+ static_cast<int64_t>(luma[2]) * wt[2] + static_cast<int64_t>(luma[3]) * wt[3];
+			dst[x] = cv::saturate_cast<uchar>((v + (int64_t(1) << (kLumaBits + kWeightBits - 1))) >> (kLumaBits + kWeightBits));
+		}
+	}
+}
+
+void CameraUndistorter::undistortRoi(const cv::Mat &in, const cv::Rect &roi, cv::Mat &out) {
+	prepare_maps(in.size());
+	out.create(in.size(), in.type());
+	out.setTo(cv::Scalar::all(0));
+	const cv::Rect r = roi & cv::Rect(0, 0, in.cols, in.rows);
+	if (r.area() == 0) {
+		return;
+	}
+	cv::Mat out_roi = out(r);
+	if (is_fixed_point_) {
+		cv::remap(in, out_roi, map_xy_(r), map_a_(r), cv::INTER_LINEAR);
+	}
+	else {
+		cv::remap(in, out_roi, mapx_(r), mapy_(r), cv::INTER_LINEAR);
+	}
+}
+
+cv::Point2f CameraUndistorter::undistortPoint(const cv::Size &image_size, const cv::Point2f &p) {
+	prepare_point_lut(image_size);
+	if (p.x < 0 || p.y < 0 || p.x > image_size.width - 1 || p.y > image_size.height - 1) {
+		// Outside of the table, solve directly
+		std::vector<cv::Point2f> src(1, p), dst;
+		cv::undistortPoints(src, dst, K0_, distCoeffs_, cv::noArray(), K0_);
+		return dst[0];
+	}
+	// Bilinear interpolation between the four surrounding grid nodes
+	const float gx = p.x / kLutStep;
+	const float gy = p.y / kLutStep;
+	const int x0 = std::min(static_cast<int>(gx), point_lut_.cols - 2);
+	const int y0 = std::min(static_cast<int>(gy), point_lut_.rows - 2);
+	const float ax = gx - x0;
+	const float ay = gy - y0;
+	const cv::Vec2f *r0 = point_lut_.ptr<cv::Vec2f>(y0);
+	const cv::Vec2f *r1 = point_lut_.ptr<cv::Vec2f>(y0 + 1);
+	const cv::Vec2f v = (r0[x0] * (1.0f - ax) + r0[x0 + 1] * ax) * (1.0f - ay)
+		+ (r1[x0] * (1.0f - ax) + r1[x0 + 1] * ax) * ay;
+	return cv::Point2f(v[0], v[1]);
+}
+
+void CameraUndistorter::undistortPoints(const cv::Size &image_size, std::vector<cv::Point2f> &points) {
+	for (auto &p : points) {
+		p = undistortPoint(image_size, p);
+	}
+}
+
+bool CameraUndistorter::undistortEllipse(const cv::Size &image_size, cv::RotatedRect &rect, std::vector<cv::Point2f> &edge_points) {
+	undistortPoints(image_size, edge_points);
+	if (edge_points.size() > 5) {
+		rect = cv::fitEllipse(edge_points);
+		return true;
+	}
+	if (rect.size.width <= 0 || rect.size.height <= 0) {
+		return false;
+	}
+	// Too few edge points: refit to points sampled along the distorted ellipse
+	std::vector<cv::Point> contour;
+	cv::ellipse2Poly(rect.center, cv::Size(cvRound(rect.size.width / 2), cvRound(rect.size.height / 2)),
+		cvRound(rect.angle), 0, 360, 20, contour);
+	std::vector<cv::Point2f> samples(contour.begin(), contour.end());
+	if (samples.size() < 5) {
+		return false;
+	}
+	undistortPoints(image_size, samples);
+	rect = cv::fitEllipse(samples);
+	return true;
+}
+
+void benchmark_undistortion(const cv::Mat &K, const cv::Vec<double, 8> &distCoeffs, const cv::Size &image_size, int iterations)
+{
+	cv::Mat bgr(image_size, CV_8UC3);
+	cv::randu(bgr, cv::Scalar::all(0), cv::Scalar::all(255));
+	cv::GaussianBlur(bgr, bgr, cv::Size(5, 5), 0); // Smooth, camera-like content
+
+	CameraUndistorter float_maps(K, distCoeffs);
+	CameraUndistorter fixed_maps(K, distCoeffs);
+	fixed_maps.setFixedPointMaps(true);
+
+	// Approximate memory traffic per output pixel: maps read + source read + destination written,
+	// plus the separate color conversion pass (3 bytes in, 1 byte out) where there is one
+	struct Path {
+		std::string name;
+		double bytes_per_pixel;
+		std::function<void(cv::Mat&)> run;
+	};
+	cv::Mat tmp;
+	std::vector<Path> paths = {
+		{ "float maps, remap BGR + cvtColor", 8 + 3 + 3 + 4,
+		[&](cv::Mat &out) { float_maps.undistort(bgr, tmp); cv::cvtColor(tmp, out, CV_BGR2GRAY); } },
+		{ "fixed maps, remap BGR + cvtColor", 6 + 3 + 3 + 4,
+		[&](cv::Mat &out) { fixed_maps.undistort(bgr, tmp); cv::cvtColor(tmp, out, CV_BGR2GRAY); } },
+		{ "cvtColor + fixed maps, remap Y8", 4 + 6 + 1 + 1,
+		[&](cv::Mat &out) { cv::cvtColor(bgr, tmp, CV_BGR2GRAY); fixed_maps.undistort(tmp, out); } },
+		{ "fused undistortGray (fixed maps)", 6 + 3 + 1,
+		[&](cv::Mat &out) { fixed_maps.undistortGray(bgr, out); } },
+	};
+
+	std::cout << "Undistortion benchmark: " << image_size.width << "x" << image_size.height << ", " << iterations << " iterations" << std::endl;
+	cv::Mat reference;
+	for (auto &path : paths) {
+		cv::Mat out;
+		path.run(out); // Warm up, builds the maps
+		const Clock::time_point start = Clock::now();
+		for (int i = 0; i < iterations; i++) {
+			path.run(out);
+		}
+		const double ms = millisecondsSince(start) / iterations;
+		if (reference.empty()) {
+			reference = out.clone();
+		}
+		double max_diff = 0;
+		cv::minMaxLoc(cv::abs(out - reference), nullptr, &max_diff);
+		const double mbytes = path.bytes_per_pixel * image_size.area() / (1024.0 * 1024.0);
+		std::cout << "  " << path.name << ": " << ms << " ms/frame, ~" << mbytes << " MB touched/frame"
+			<< ", max diff to float path=" << max_diff << std::endl;
+	}
+}
+
+} // namespace
@@ -0,0 +1,140 @@
+#ifndef CAMERA_UNDISTORTER_H
+#define CAMERA_UNDISTORTER_H
+
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "frame.h"
+
+namespace eye_tracker
+{
+void benchmark_undistortion(const cv::Mat &K, const cv::Vec<double, 8> &distCoeffs, const cv::Size &image_size, int iterations = 200);
+
+/// Where lens distortion is removed in the tracking loop
+enum class UndistortMode {
+	FULL_FRAME, ///< Remap every captured frame before the 2D detection
+	POINTS      ///< Detect on the raw frame and undistort only the pupil ellipse and its edge points
+};
+
+/**
+* @class CameraUndistorter
+* @brief Image undistortion class. This class keeps undistortion map for efficiency
+*
+* Besides the full-frame remap it can undistort individual image points through
+* a cached inverse-distortion lookup table, so that only the detected pupil
+* ellipse is corrected, and remap just a region of interest of a frame.
+*
+* Full-frame maps are either float (CV_32FC1 x/y) or OpenCV's compact fixed-point
+* format (CV_16SC2 integer coordinates plus a CV_16UC1 index into a table of
+* bilinear weights). undistortGray() fuses the remap of a BGR image with the
+* conversion to grayscale, so the color image is read once and only one
+* channel is written.
+*/
+class CameraUndistorter
+{
+public:
+	/// Grid spacing of the inverse-distortion table in pixels; points in between are interpolated
+	static const int kLutStep = 4;
+
+	CameraUndistorter(const cv::Mat &K, const cv::Vec<double, 8> &distCoeffs);
+	~CameraUndistorter() {
+	}
+	void init_maps(const cv::Size &s);
+	void init_fixed_point_maps(const cv::Size &s);
+	void init_point_lut(const cv::Size &s);
+
+	/// Builds the maps and the point table for an image size ahead of use. Afterwards all
+	/// undistort calls for that size only read them, so they may run on several threads
+	void prepare(const cv::Size &s) {
+		prepare_maps(s);
+		prepare_fixed_point_maps(s);
+		prepare_point_lut(s);
+	}
+
+	/// Selects fixed-point (6 bytes per pixel) instead of float (8 bytes per pixel) remap maps
+	void setFixedPointMaps(bool is_fixed_point) { is_fixed_point_ = is_fixed_point; }
+	bool isFixedPointMaps() const { return is_fixed_point_; }
+
+	void undistort(const cv::Mat &in, cv::Mat &out);
+	/// Undistorts the image of a frame and carries its capture record over to the output
+	void undistort(const Frame &in, Frame &out) {
+		undistort(in.image, out.image);
+		out.info = in.info;
+	}
+
+	/**
+	Undistorts an 8 bit BGR image and converts it to grayscale in one pass.
+	A single channel input is only undistorted.
+	@param in 8 bit, 1 or 3 channel distorted image
+	@param out undistorted 8 bit single channel image. Must not share data with in
+	*/
+	void undistortGray(const cv::Mat &in, cv::Mat &out);
+	/// Undistorts and converts a frame to Y8, carrying its capture record over to the output
+	void undistortGray(const Frame &in, Frame &out) {
+		undistortGray(in.image, out.image);
+		out.info = in.info;
+		out.info.format = PixelFormat::Y8;
+	}
+
+	/**
+	Undistorts only a region of an image.
+	@param in distorted input image
+	@param roi region of the undistorted image to compute; clipped to the image
+	@param out image of the input size and type; pixels outside roi are set to 0. Must not share data with in
+	*/
+	void undistortRoi(const cv::Mat &in, const cv::Rect &roi, cv::Mat &out);
+
+	/// Maps a distorted pixel position of an image of the given size to its undistorted position
+	cv::Point2f undistortPoint(const cv::Size &image_size, const cv::Point2f &p);
+	void undistortPoints(const cv::Size &image_size, std::vector<cv::Point2f> &points);
+
+	/**
+	Undistorts a 2D pupil ellipse detected on a distorted image.
+	The ellipse is refitted to its undistorted edge points; if there are
+	too few of them, points sampled along the ellipse are used instead.
+	@param image_size size of the image the ellipse was detected on
+	@param rect ellipse, replaced by the undistorted one
+	@param edge_points edge points the ellipse was fitted to, undistorted in place
+	@return false if no ellipse could be fitted
+	*/
+	bool undistortEllipse(const cv::Size &image_size, cv::RotatedRect &rect, std::vector<cv::Point2f> &edge_points);
+
+protected:
+	void prepare_maps(const cv::Size &s) {
+		if ((is_fixed_point_ ? map_xy_.size() : mapx_.size()) != s) {
+			init_maps(s);
+		}
+	}
+	void prepare_fixed_point_maps(const cv::Size &s) {
+		if (map_xy_.size() != s) {
+			init_fixed_point_maps(s);
+		}
+	}
+	void prepare_point_lut(const cv::Size &s) {
+		if (lut_image_size_ != s) {
+			init_point_lut(s);
+		}
+	}
+
+	// Local variables initialized at the constructor
+	cv::Mat K0_;
+	cv::Vec<double, 8> distCoeffs_; // (k1 k2 p1 p2 [k3 [k4 k5 k6]])
+	bool is_fixed_point_ = false;
+	cv::Mat mapx_, mapy_;    // Float maps, CV_32FC1
+	cv::Mat map_xy_, map_a_; // Fixed-point maps, CV_16SC2 and CV_16UC1
+
+	// Bilinear weights of the fixed-point maps, indexed by map_a_, scaled by 1 << kWeightBits
+	static const int kWeightBits = 15;
+	std::vector<cv::Vec4i> weights_;
+
+	// Undistorted positions of the distorted pixel grid (x, y) * kLutStep, CV_32FC2
+	cv::Mat point_lut_;
+	cv::Size lut_image_size_;
+private:
+	// Prevent copying
+	CameraUndistorter(const CameraUndistorter& other);
+	CameraUndistorter& operator=(const CameraUndistorter& rhs);
+};
+
+} // namespace
+#endif // CAMERA_UNDISTORTER_H
@@ -0,0 +1,47 @@
+#ifndef CAMERA_WORKERS_H
+#define CAMERA_WORKERS_H
+
+#include <cstddef>
+#include <functional>
+#include "task_scheduler.h"
+
+namespace eye_tracker
+{
+
+/**
+* @class CameraWorkers
+* @brief Runs the work of all cameras of one capture tick at the same time.
+*
+* run() calls work(cam) for every camera and returns once all calls are done,
+* so the results of a tick are joined before they are used. The calls run on
+* the shared TaskScheduler and the calling thread, at most threads at a time;
+* a camera's tracker is used by one call at a time, so two eyes take as long
+* as one. With one thread, run() just loops over the cameras.
+*/
+class CameraWorkers
+{
+public:
+	/// @param threads number of cameras processed at the same time, including the calling thread
+	explicit CameraWorkers(size_t threads, TaskScheduler &scheduler = TaskScheduler::shared())
+		: threads_(threads < 1 ? 1 : threads), scheduler_(scheduler)
+	{
+	}
+
+	/// Calls work(cam) for cam = 0..count-1 in parallel and waits for all of them.
+	/// An exception thrown by any call is rethrown here
+	void run(size_t count, const std::function<void(size_t cam)> &work) {
+		scheduler_.parallel_for(count, work, threads_);
+	}
+	size_t threads() const { return threads_; }
+
+protected:
+	const size_t threads_;
+	TaskScheduler &scheduler_;
+private:
+	// Prevent copying
+	CameraWorkers(const CameraWorkers& other);
+	CameraWorkers& operator=(const CameraWorkers& rhs);
+};
+
+} // namespace
+#endif // CAMERA_WORKERS_H
@@ -1,5 +1,6 @@
 #include <iostream>
 #include "eye_cameras.h"
+#include "stream_recorder.h"
 
 #include "timer.h"
 
@@ -17,7 +18,7 @@ void record_eyecams_mono_interactive(){
 	const size_t kCcameraNums = 1;
 
 	// Open and check cameras
-	cv::Mat images[kCcameraNums];
+	Frame frames[kCcameraNums];
 	EyeCamera eyecams[kCcameraNums] = { EyeCamera(0,true)};
 	std::string window_names[kCcameraNums] = { "Cam0" };
 	for (size_t cam = 0; cam < kCcameraNums; cam++){
@@ -28,25 +29,21 @@ void record_eyecams_mono_interactive(){
 		}
 		// Capture single frames to get image sizes;
 		for (size_t cam = 0; cam < kCcameraNums; cam++){
-			eyecams[cam].fetchFrame(images[cam]);
-			if (images[cam].empty()){
+			eyecams[cam].fetchFrame(frames[cam]);
+			if (frames[cam].image.empty()){
 				std::cout << "Could not capture an image" << std::endl;
 				return;
 			}
 		}
 	}
 
-	// Save buffered images to files
-	std::ostringstream ost_frame_id;
-	const std::string kDir = "./tmp/";
-	const std::streamsize kStreamSize = 3;
-	const char kPaddingChar = '0';
-	const std::string kImageFormat = "png";
-	cv::VideoWriter outputVideos[kCcameraNums];
+	// Recorders write the frames selected with 't' on their own threads
+	std::unique_ptr<StreamRecorder> recorders[kCcameraNums];
 	for (size_t cam = 0; cam < kCcameraNums; cam++){
-		std::ostringstream ost_video_name;
-		ost_video_name << kDir << "cam" << cam << ".avi";
-		outputVideos[cam].open(ost_video_name.str(), -1, 30, images[cam].size());
+		RecorderOptions options;
+		options.stem = "cam" + std::to_string(cam);
+		options.write_images = true;
+		recorders[cam] = std::make_unique<StreamRecorder>(options);
 	}
 	// Capture and store images
 	size_t frame_count = 0;
@@ -58,24 +55,20 @@ void record_eyecams_mono_interactive(){
 
 		// First fetch images
 		for (size_t cam = 0; cam < kCcameraNums; cam++){
-			eyecams[cam].fetchFrame(images[cam]);
-			if (images[cam].empty()){
+			eyecams[cam].fetchFrame(frames[cam]);
+			if (frames[cam].image.empty()){
 				std::cout << "Could not capture an image" << std::endl;
 				return;
 			}
 		}
 		for (size_t cam = 0; cam < kCcameraNums; cam++){
-			cv::imshow(window_names[cam], images[cam]);
+			cv::imshow(window_names[cam], frames[cam].image);
 		}
 		switch (cv::waitKey(5))
 		{
 		case 't':
 		for (size_t cam = 0; cam < kCcameraNums; cam++){
-			ost_frame_id.str("");
-			ost_frame_id.clear();
-			ost_frame_id << "cam" << cam << "_" << std::setw(kStreamSize) << std::setfill(kPaddingChar) << frame_count << "." << kImageFormat;
-			cv::imwrite(kDir + ost_frame_id.str(), images[cam]);
-			outputVideos[cam] << images[cam];
+			recorders[cam]->record(frames[cam]);
 		}
 			break;
 		case 'q':
@@ -94,177 +87,76 @@ void record_eyecams_mono_interactive(){
 	}
 }
 
-void record_eyecams_mono(){
-	const size_t kMaxCaptureFrame = 300;
-	const size_t kCcameraNums = 1;
-
-	// Open and check cameras
-	std::vector<std::unique_ptr<eye_tracker::EyeCameraParent>> eyecams(kCcameraNums); // Image sources
-	cv::Mat images[kCcameraNums];
-	eyecams[0] = std::make_unique<eye_tracker::EyeCameraDS>("Pupil Cam1 ID2");
-	std::string window_names[kCcameraNums] = { "Cam0" };
-	for (size_t cam = 0; cam < kCcameraNums; cam++){
+namespace {
+/// Streams frames of the given cameras to ./tmp/camN.* until 'q' is pressed
+void stream_eyecams(std::vector<std::unique_ptr<EyeCameraParent>> &eyecams, bool is_raw_video){
+	const size_t kCameraNums = eyecams.size();
+	std::vector<Frame> frames(kCameraNums);
+	std::vector<std::unique_ptr<StreamRecorder>> recorders(kCameraNums);
+	for (size_t cam = 0; cam < kCameraNums; cam++){
 		// Check if the cameras are opened
 		if (eyecams[cam]->isOpened() == false){
 			std::cout << "Could not open the camera" << std::endl;
 			return;
 		}
-		// Capture single frames to get image sizes;
-		for (size_t cam = 0; cam < kCcameraNums; cam++){
-			eyecams[cam]->fetchFrame(images[cam]);
-			if (images[cam].empty()){
-				std::cout << "Could not capture an image" << std::endl;
-				return;
-			}
-		}
-	}
-	
-	// Create an image buffer size of the number of cameras and their frame length
-	cv::Mat buffer_images[kCcameraNums][kMaxCaptureFrame];
-	for (size_t i = 0; i < kMaxCaptureFrame; i++){
-		for (size_t cam = 0; cam < kCcameraNums; cam++){
-			buffer_images[cam][i] = cv::Mat::zeros(images[0].size(), images[0].type());
-		}
+		RecorderOptions options;
+		options.stem = "cam" + std::to_string(cam);
+		options.write_video = (is_raw_video == false);
+		options.write_images = (is_raw_video == false);
+		options.write_raw_video = is_raw_video;
+		recorders[cam] = std::make_unique<StreamRecorder>(options);
 	}
 
-	// Capture and store images
+	// Capture and record images
 	size_t frame_count = 0;
 	timer timer0;
 	timer0.pause();
-	for( size_t i = 0; i < kMaxCaptureFrame; i++){
-		//	while (frame_count<kMaxCaptureFrame && cv::waitKey(5) != 'q'){
-
+	while (cv::waitKey(5) != 'q'){
 		// First fetch images
-		for (size_t cam = 0; cam < kCcameraNums; cam++){
-			eyecams[cam]->fetchFrame(images[cam]);
-			if (images[cam].empty()){
+		for (size_t cam = 0; cam < kCameraNums; cam++){
+			eyecams[cam]->fetchFrame(frames[cam]);
+			if (frames[cam].image.empty()){
 				std::cout << "Could not capture an image" << std::endl;
 				return;
 			}
 		}
 
-		// Copy the cpatured images to the buffer
-		for (size_t cam = 0; cam < kCcameraNums; cam++){
-			cv::Mat &img = images[cam];
-			cv::imshow(window_names[cam], img);
-			img.copyTo(buffer_images[cam][i]);
+		// Hand the captured images to the recorders; writing happens on their threads
+		for (size_t cam = 0; cam < kCameraNums; cam++){
+			cv::imshow("Cam" + std::to_string(cam), frames[cam].image);
+			recorders[cam]->record(frames[cam]);
 		}
 
-		cv::waitKey(5);
 		// Compute FPS
 		frame_count++;
 		const size_t kSkipFrameCount = 50;
 		if (frame_count == kSkipFrameCount)timer0.resume(); /// Wait measuring time until the process gets stabilized
-		const double kFPS = (frame_count - kSkipFrameCount) / timer0.elapsed();
-		std::cout << "FPS=" << kFPS << ", 2D pupil params " << std::endl; // Print current frame data
-	}
-	
-	// Save buffered images to files
-	std::ostringstream ost_frame_id;
-	const std::string kDir = "./tmp/";
-	const std::streamsize kStreamSize = 3;
-	const char kPaddingChar = '0';
-	const std::string kImageFormat = "png";
-	for (size_t cam = 0; cam < kCcameraNums; cam++){
-		std::ostringstream ost_video_name;
-		ost_video_name << kDir<<"cam" << cam << ".avi";
-		cv::VideoWriter outputVideo(ost_video_name.str(), -1, 30, buffer_images[cam][0].size());
-		for (size_t i = 0; i < kMaxCaptureFrame; i++){
-			ost_frame_id.str("");
-			ost_frame_id.clear();
-			ost_frame_id << "cam"<<cam<<"_"<<std::setw(kStreamSize) << std::setfill(kPaddingChar) << i<<"."<<kImageFormat;
-			cv::imwrite(kDir + ost_frame_id.str(),buffer_images[cam][i]);
-			outputVideo << buffer_images[cam][i];
+		if (frame_count > kSkipFrameCount && frame_count % 100 == 0){
+			const double kFPS = (frame_count - kSkipFrameCount) / timer0.elapsed();
+			std::cout << "FPS=" << kFPS << std::endl;
+			for (size_t cam = 0; cam < kCameraNums; cam++){
+				const RecorderStatistics stats = recorders[cam]->statistics();
+				std::cout << "  Cam" << cam << ": written=" << stats.written << ", dropped=" << stats.dropped
+					<< ", queue peak=" << stats.queue_peak << std::endl;
+			}
 		}
 	}
+	// Recorders flush the remaining frames when they are destroyed
+}
+}
 
-
+void record_eyecams_mono(){
+	const bool kRecordRawVideo = false; // Write a raw eye video (camN.eyeraw) instead of AVI and PNG files
+	std::vector<std::unique_ptr<eye_tracker::EyeCameraParent>> eyecams(1); // Image sources
+	eyecams[0] = std::make_unique<eye_tracker::EyeCameraDS>("Pupil Cam1 ID2");
+	stream_eyecams(eyecams, kRecordRawVideo);
 }
 
 void record_eyecams(){
-	const size_t kMaxCaptureFrame = 100;
-	const size_t kCcameraNums = 2;
-
-	// Open and check cameras
-	cv::Mat images[kCcameraNums];
-	EyeCamera eyecams[kCcameraNums] = { EyeCamera(0), EyeCamera(2, true) };
-	std::string window_names[kCcameraNums] = { "Cam0", "Cam1" };
-	for (size_t cam = 0; cam < kCcameraNums; cam++){
-		// Check if the cameras are opened
-		if (eyecams[cam].isOpened() == false){
-			std::cout << "Could not open the camera" << std::endl;
-			return;
-		}
-		// Capture single frames to get image sizes;
-		for (size_t cam = 0; cam < kCcameraNums; cam++){
-			eyecams[cam].fetchFrame(images[cam]);
-			if (images[cam].empty()){
-				std::cout << "Could not capture an image" << std::endl;
-				return;
-			}
-		}
-	}
-	
-	// Create an image buffer size of the number of cameras and their frame length
-	cv::Mat buffer_images[kCcameraNums][kMaxCaptureFrame];
-	for (size_t i = 0; i < kMaxCaptureFrame; i++){
-		for (size_t cam = 0; cam < kCcameraNums; cam++){
-			buffer_images[cam][i] = cv::Mat::zeros(images[0].size(), images[0].type());
-		}
-	}
-
-	// Capture and store images
-	size_t frame_count = 0;
-	timer timer0;
-	timer0.pause();
-	for( size_t i = 0; i < kMaxCaptureFrame; i++){
-		//	while (frame_count<kMaxCaptureFrame && cv::waitKey(5) != 'q'){
-
-		// First fetch images
-		for (size_t cam = 0; cam < kCcameraNums; cam++){
-			eyecams[cam].fetchFrame(images[cam]);
-			if (images[cam].empty()){
-				std::cout << "Could not capture an image" << std::endl;
-				return;
-			}
-		}
-
-		// Copy the cpatured images to the buffer
-		for (size_t cam = 0; cam < kCcameraNums; cam++){
-			cv::Mat &img = images[cam];
-			cv::imshow(window_names[cam], img);
-			img.copyTo(buffer_images[cam][i]);
-		}
-
-		cv::waitKey(5);
-		// Compute FPS
-		frame_count++;
-		const size_t kSkipFrameCount = 50;
-		if (frame_count == kSkipFrameCount)timer0.resume(); /// Wait measuring time until the process gets stabilized
-		const double kFPS = (frame_count - kSkipFrameCount) / timer0.elapsed();
-		std::cout << "FPS=" << kFPS << ", 2D pupil params " << std::endl; // Print current frame data
-	}
-	
-	// Save buffered images to files
-	std::ostringstream ost_frame_id;
-	const std::string kDir = "./tmp/";
-	const std::streamsize kStreamSize = 3;
-	const char kPaddingChar = '0';
-	const std::string kImageFormat = "png";
-	for (size_t cam = 0; cam < kCcameraNums; cam++){
-		std::ostringstream ost_video_name;
-		ost_video_name << kDir<<"cam" << cam << ".avi";
-		cv::VideoWriter outputVideo(ost_video_name.str(), -1, 30, buffer_images[cam][0].size());
-		for (size_t i = 0; i < kMaxCaptureFrame; i++){
-			ost_frame_id.str("");
-			ost_frame_id.clear();
-			ost_frame_id << "cam"<<cam<<"_"<<std::setw(kStreamSize) << std::setfill(kPaddingChar) << i<<"."<<kImageFormat;
-			cv::imwrite(kDir + ost_frame_id.str(),buffer_images[cam][i]);
-			outputVideo << buffer_images[cam][i];
-		}
-	}
-
-
+	std::vector<std::unique_ptr<eye_tracker::EyeCameraParent>> eyecams(2); // Image sources
+	eyecams[0] = std::make_unique<eye_tracker::EyeCamera>(0);
+	eyecams[1] = std::make_unique<eye_tracker::EyeCamera>(2, true);
+	stream_eyecams(eyecams, false);
 }
 
 
@@ -280,19 +172,19 @@ void test_eyecam(){
 	EyeCamera eyecamR(2);
 	EyeCamera eyecamW(1);
 	if (eyecamL.isOpened() && eyecamR.isOpened()){
-		cv::Mat imgL, imgR, imgW;
+		Frame frameL, frameR, frameW;
 		size_t frame_count = 0;
 		size_t kSkipFrameCount = 50;
 		timer timer0;
 		timer0.pause();
 		while (1){
 
-			eyecamL.fetchFrame(imgL);
-			eyecamR.fetchFrame(imgR);
-			eyecamW.fetchFrame(imgW);
-			cv::imshow("camera left", imgL);
-			cv::imshow("camera right", imgR);
-			cv::imshow("camera world", imgW);
+			eyecamL.fetchFrame(frameL);
+			eyecamR.fetchFrame(frameR);
+			eyecamW.fetchFrame(frameW);
+			cv::imshow("camera left", frameL.image);
+			cv::imshow("camera right", frameR.image);
+			cv::imshow("camera world", frameW.image);
 			if (cv::waitKey(1) == 'q')break;
 
 			// Compute and print FPS
@@ -330,20 +222,20 @@ void EyeCamera::check_cap_condition(){
 EyeCamera::EyeCamera(){
 
 }
-EyeCamera::EyeCamera(const int cam_id, bool is_flipped)
+EyeCamera::EyeCamera(const int cam_id, bool is_flipped, const CameraMode &mode)
 {
-	init(cam_id, is_flipped);
+	init(cam_id, is_flipped, mode);
 }
-void EyeCamera::init(const int cam_id, bool is_flipped)
+void EyeCamera::init(const int cam_id, bool is_flipped, const CameraMode &mode)
 {
 	is_flipped_=is_flipped;
 	std::cout << "EyeCamera: Open a camera of index: "<< cam_id << std::endl;
 	cap_.open(CV_CAP_DSHOW+ cam_id);
 	check_cap_condition();
-	cap_.set(CV_CAP_PROP_FRAME_WIDTH, 640);
-	cap_.set(CV_CAP_PROP_FRAME_HEIGHT, 480);
-	cap_.set(CV_CAP_PROP_FPS, 120);
-	std::cout << "EyeCamera: Camera setting: " << std::endl;
+	cap_.set(CV_CAP_PROP_FRAME_WIDTH, mode.size.width);
+	cap_.set(CV_CAP_PROP_FRAME_HEIGHT, mode.size.height);
+	cap_.set(CV_CAP_PROP_FPS, mode.fps);
+	std::cout << "EyeCamera: Camera setting (requested " << mode.size.width << "x" << mode.size.height << "@" << mode.fps << "): " << std::endl;
 	std::cout << "EyeCamera: Width: " << cap_.get(CV_CAP_PROP_FRAME_WIDTH) << std::endl;
 	std::cout << "EyeCamera: Height: " << cap_.get(CV_CAP_PROP_FRAME_HEIGHT) << std::endl;
 	std::cout << "EyeCamera: FPS: " << cap_.get(CV_CAP_PROP_FPS) << std::endl;
@@ -360,7 +252,7 @@ void EyeCamera::init(const std::string file_name, bool is_flipped)
 	fs::path data_file_path(file_name);
 	std::cout << "EyeCamera: Open a video file: " << file_name << std::endl;
 	const std::string kEXT = data_file_path.extension().string();
-	if (kEXT == ".avi" || kEXT == ".mp4"){
+	if (kEXT == ".avi" || kEXT == ".mp4" || kEXT == ".wmv"){
 		cap_.open(data_file_path.string());
 		std::cout << "Open a video file: " << file_name << std::endl;
 		check_cap_condition();
@@ -373,15 +265,26 @@ void EyeCamera::init(const std::string file_name, bool is_flipped)
 	}
 }
 
-void EyeCamera::fetchFrame(cv::Mat &frame){
+void EyeCamera::fetchFrame(Frame &frame){
+	const bool is_mono = (pixel_format_ == PixelFormat::Y8);
 	if (is_image_==false){
-		cap_ >> frame;
+		if (is_mono){
+			cap_ >> grab_buffer_;
+			convertToMono(grab_buffer_, frame.image);
+		}
+		else{
+			cap_ >> frame.image;
+		}
 	}
 	else
 	{
-		frame = mono_img_.clone();
+		if (is_mono && mono_img_.channels() != 1){
+			convertToMono(mono_img_.clone(), mono_img_); // Convert the still image only once
+		}
+		mono_img_.copyTo(frame.image); // Reuses the caller's buffer
 	}
-	if (is_flipped_) cv::flip(frame, frame, -1);//flip both
+	stampFrame(frame);
+	if (is_flipped_) cv::flip(frame.image, frame.image, -1);//flip both
 }
 
 
@@ -398,8 +301,148 @@ EyeCameraDS::~EyeCameraDS(){
 bool EyeCameraDS::isOpened(){
 	return true;
 }
-void EyeCameraDS::fetchFrame(cv::Mat &frame){
-	DSfg.getFrame(frame);
+void EyeCameraDS::fetchFrame(Frame &frame){
+	if (pixel_format_ == PixelFormat::Y8){
+		DSfg.getFrame(grab_buffer_);
+		convertToMono(grab_buffer_, frame.image);
+	}
+	else{
+		DSfg.getFrame(frame.image);
+	}
+	stampFrame(frame);
+}
+
+
+
+namespace {
+/// Gives a buffer back to a ring slot unless someone else still references it
+void recycle(Frame &frame){
+	if (frame.image.u != nullptr && frame.image.u->refcount > 1) {
+		frame.image.release();
+	}
+}
+}
+
+EyeCameraThreaded::EyeCameraThreaded(std::unique_ptr<EyeCameraParent> source, FramePolicy policy, size_t capacity, bool is_live)
+	: source_(std::move(source)), ring_(policy, capacity), is_live_(is_live),
+	is_running_(true), is_eos_(false)
+{
+	source_id_ = source_->sourceId();
+	pixel_format_ = source_->pixelFormat();
+	// Grab a first frame synchronously to learn the frame geometry and allocate all slots up front
+	Frame probe;
+	source_->fetchFrame(probe);
+	if (probe.empty()){
+		throw "EyeCameraThreaded: could not capture a first frame";
+	}
+	const cv::Size size = probe.image.size();
+	const int type = probe.image.type();
+	ring_.preallocate([&](Frame &slot){ slot.image.create(size, type); });
+	discard_.image.create(size, type);
+	Frame *slot = ring_.acquire_write();
+	swap(*slot, probe);
+	ring_.commit_write();
+
+	std::cout << "EyeCameraThreaded: " << size.width << "x" << size.height << ", "
+		<< ring_.capacity() << " slots, policy: "
+		<< (ring_.policy() == FramePolicy::LATEST_FRAME ? "latest frame" : "every frame") << std::endl;
+	start();
+}
+EyeCameraThreaded::~EyeCameraThreaded(){
+	stop();
+}
+bool EyeCameraThreaded::isOpened(){
+	return source_->isOpened();
+}
+void EyeCameraThreaded::setSourceId(int source_id){
+	// Frames are stamped by the wrapped source on the capture thread
+	source_id_ = source_id;
+	source_->setSourceId(source_id);
+}
+void EyeCameraThreaded::setPixelFormat(PixelFormat format){
+	// The source reads its format on the capture thread, so pause capture while changing it.
+	// Frames already in the ring keep their own format in their capture record.
+	stop();
+	pixel_format_ = format;
+	source_->setPixelFormat(format);
+	start();
+}
+void EyeCameraThreaded::start(){
+	is_running_ = true;
+	thread_ = std::thread(&EyeCameraThreaded::run, this);
+	if (thread_policy_.is_set()){
+		apply_thread_policy(thread_, "Capture " + std::to_string(source_id_), thread_policy_, thread_policy_index_);
+	}
+}
+void EyeCameraThreaded::stop(){
+	is_running_ = false;
+	notify();
+	if (thread_.joinable()) thread_.join();
+}
+void EyeCameraThreaded::notify(){
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (on_frame_) on_frame_();
+	}
+	cv_.notify_all();
+}
+void EyeCameraThreaded::setFrameCallback(std::function<void()> on_frame){
+	std::lock_guard<std::mutex> lock(mutex_);
+	on_frame_ = std::move(on_frame);
+}
+ThreadPolicyResult EyeCameraThreaded::setThreadPolicy(const ThreadPolicy &policy, size_t index){
+	thread_policy_ = policy;
+	thread_policy_index_ = index;
+	return apply_thread_policy(thread_, "Capture " + std::to_string(source_id_), policy, index);
+}
+void EyeCameraThreaded::run(){
+	while (is_running_){
+		Frame *slot = ring_.acquire_write();
+		if (slot == nullptr){
+			if (is_live_){
+				// Keep draining the camera so its driver queue never backs up
+				source_->fetchFrame(discard_);
+				ring_.count_drop();
+			}
+			else{
+				std::unique_lock<std::mutex> lock(mutex_);
+				cv_.wait(lock, [this]{ return ring_.acquire_write() != nullptr || !is_running_; });
+			}
+			continue;
+		}
+		source_->fetchFrame(*slot);
+		if (slot->empty()){
+			is_eos_ = true; // End of a video file or a lost camera
+			notify();
+			return;
+		}
+		ring_.commit_write();
+		notify();
+	}
+}
+void EyeCameraThreaded::fetchFrame(Frame &frame){
+	Frame *slot = ring_.acquire_read();
+	if (slot == nullptr){
+		std::unique_lock<std::mutex> lock(mutex_);
+		cv_.wait(lock, [this]{ return ring_.readable() || is_eos_; });
+		slot = ring_.acquire_read();
+		if (slot == nullptr){
+			frame.image.release(); // End of stream, same as an empty frame from the source
+			return;
+		}
+	}
+	recycle(frame);
+	swap(frame, *slot);
+	ring_.release_read();
+	if (is_live_ == false) notify(); // Wake up a producer waiting for a free slot
+}
+CaptureStatistics EyeCameraThreaded::statistics() const{
+	CaptureStatistics stats;
+	stats.captured = ring_.pushed();
+	stats.delivered = ring_.popped();
+	stats.dropped = ring_.dropped();
+	stats.overwritten = ring_.overwritten();
+	return stats;
 }
 
 
@@ -2,8 +2,19 @@
 #define EYE_CAMERAS_H
 
 #include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 #include "DirectShowFrameGrabber.h"
+#include "frame.h"
+#include "frame_ring.h"
+#include "camera_undistorter.h"
+#include "thread_policy.h"
 
 namespace eye_tracker
 {
@@ -13,11 +24,49 @@ void record_eyecams_mono();
 void record_eyecams_mono_interactive();
 
 
+/**
+* @class EyeCameraParent
+* @brief Interface of all image sources. fetchFrame delivers the next image
+* together with its capture record (time, sequence number, source id, format)
+*/
 class EyeCameraParent{
 public:
 	virtual ~EyeCameraParent() {};
 	virtual bool isOpened() = 0;
-	virtual void fetchFrame(cv::Mat &frame)=0;
+	virtual void fetchFrame(Frame &frame)=0;
+	virtual void setSourceId(int source_id){ source_id_ = source_id; }
+	int sourceId() const { return source_id_; }
+	/// Selects the delivered pixel format. With Y8, BGR devices/files are converted once at ingest
+	virtual void setPixelFormat(PixelFormat format){ pixel_format_ = format; }
+	PixelFormat pixelFormat() const { return pixel_format_; }
+protected:
+	/// Fills the capture record of a just grabbed frame. Call right after the grab returns
+	void stampFrame(Frame &frame){
+		if (frame.image.empty()) return; // End of stream, nothing was captured
+		frame.info.capture_time = Clock::now();
+		frame.info.source_id = source_id_;
+		frame.info.format = toPixelFormat(frame.image);
+		frame.info.sequence = sequence_++;
+	}
+	/// Converts a grabbed image to single channel 8 bit
+	static void convertToMono(const cv::Mat &grabbed, cv::Mat &mono){
+		if (grabbed.empty()) {
+			mono.release();
+		}
+		else if (grabbed.channels() == 3) {
+			cv::cvtColor(grabbed, mono, CV_BGR2GRAY);
+		}
+		else if (grabbed.channels() == 4) {
+			cv::cvtColor(grabbed, mono, CV_BGRA2GRAY);
+		}
+		else {
+			grabbed.copyTo(mono);
+		}
+	}
+	int source_id_ = 0;
+	uint64_t sequence_ = 0;
+	PixelFormat pixel_format_ = PixelFormat::BGR8;
+	cv::Mat grab_buffer_; // Device/file image before conversion to the delivered format
 };
 
 class EyeCameraDS :public EyeCameraParent{
@@ -25,12 +74,18 @@ public:
 	EyeCameraDS(std::string cam_name);
 	~EyeCameraDS();
 	bool isOpened();
-	void fetchFrame(cv::Mat &frame);
+	void fetchFrame(Frame &frame);
 protected:
 private:
 	Ubitrack::Drivers::DirectShowFrameGrabber DSfg;
 };
 
+/// Resolution and frame rate requested from a camera
+struct CameraMode {
+	cv::Size size = cv::Size(640, 480);
+	double fps = 120;
+};
+
 /**
 * @class EyeCamera
 * @brief A camera object to access eye cameras
@@ -38,15 +93,15 @@ private:
 class EyeCamera:public EyeCameraParent{
 public:
 	EyeCamera();
-	EyeCamera(const int cam_id, bool is_flipped = false);
+	EyeCamera(const int cam_id, bool is_flipped = false, const CameraMode &mode = CameraMode());
 	EyeCamera(const std::string file_name, bool is_flipped=false);
-	void init(const int cam_id, bool is_flipped = false);
+	void init(const int cam_id, bool is_flipped = false, const CameraMode &mode = CameraMode());
 	void init(const std::string file_name, bool is_flipped=false);
 
 	~EyeCamera(){
 	}
 	bool isOpened(){ return cap_.isOpened(); }
-	void fetchFrame(cv::Mat &frame);
+	void fetchFrame(Frame &frame);
 protected:
 	cv::VideoCapture cap_;
 	bool is_flipped_ = false;
@@ -61,42 +116,66 @@ private:
 	EyeCamera& operator=(const EyeCamera& rhs);
 };
 
+/// Frame counters of a threaded capture stage
+struct CaptureStatistics {
+	size_t captured = 0;    ///< Frames grabbed from the source and published to the ring
+	size_t delivered = 0;   ///< Frames handed to the consumer through fetchFrame
+	size_t dropped = 0;     ///< Frames grabbed while the ring was full and thrown away
+	size_t overwritten = 0; ///< Frames replaced by a newer one before the consumer read them
+};
 
 /**
-* @class CameraUndistorter
-* @brief Image undistortion class. This class keeps undistortion map for efficiency
+* @class EyeCameraThreaded
+* @brief Runs any EyeCameraParent on its own producer thread.
+*
+* Frames are grabbed into a FrameRing of preallocated buffers, so a slow
+* consumer never stalls the camera. fetchFrame swaps the buffer out of the
+* ring instead of copying it. Live sources drop frames when an EVERY_FRAME
+* ring is full; file sources (is_live = false) wait for a free slot instead,
+* so offline replays stay lossless.
 */
-class CameraUndistorter
-{
+class EyeCameraThreaded :public EyeCameraParent{
 public:
-	CameraUndistorter(const cv::Mat &K, const cv::Vec<double, 8> &distCoeffs)
-		: K0_(K.clone()), distCoeffs_(distCoeffs)
-	{
-		std::cout << "Intrinsic (matrix): " << K0_ << std::endl;
-		std::cout << "Intrinsic (distortion): " << distCoeffs_ << std::endl;
-
-	}
-	~CameraUndistorter() {
-	}
-	void init_maps(const cv::Size &s) {
-		cv::initUndistortRectifyMap(K0_, distCoeffs_, cv::Mat(), K0_, s, CV_32FC1, mapx_, mapy_);
-	}
-	void undistort(const cv::Mat &in, cv::Mat &out) {
-		if (is_dist_map_initialized_ == false) {
-			init_maps(in.size());
-			is_dist_map_initialized_ = true;
-		}
-		cv::remap(in, out, mapx_, mapy_, cv::INTER_LINEAR);
-	}
+	EyeCameraThreaded(std::unique_ptr<EyeCameraParent> source, FramePolicy policy = FramePolicy::LATEST_FRAME,
+		size_t capacity = 8, bool is_live = true);
+	~EyeCameraThreaded();
+	bool isOpened();
+	void fetchFrame(Frame &frame);
+	void setSourceId(int source_id);
+	void setPixelFormat(PixelFormat format);
+	CaptureStatistics statistics() const;
+	/// True if fetchFrame would return without waiting: a frame is ready or the stream has ended
+	bool isFrameReady() const { return ring_.readable() || is_eos_; }
+	/// Calls on_frame whenever a frame is published, a frame is taken or the stream ends, e.g. to wake
+	/// up a scheduler. It runs on the capture or the consumer thread and must not call back into this camera
+	void setFrameCallback(std::function<void()> on_frame);
+	/// Pins the capture thread to core policy.cores[index % size] and raises its priority, now and
+	/// whenever the thread is restarted. Returns what was achieved
+	ThreadPolicyResult setThreadPolicy(const ThreadPolicy &policy, size_t index = 0);
 protected:
-	// Local variables initialized at the constructor
-	cv::Mat K0_;
-	cv::Vec<double, 8> distCoeffs_; // (k1 k2 p1 p2 [k3 [k4 k5 k6]])
-	bool is_dist_map_initialized_ = false;
-	cv::Mat mapx_, mapy_;
+	void start();
+	void stop();
+	void run();
+	void notify();
+
+	std::unique_ptr<EyeCameraParent> source_;
+	FrameRing<Frame> ring_;
+	const bool is_live_;
+	Frame discard_; // Grab target when a live source overruns the ring
+	std::atomic<bool> is_running_;
+	std::atomic<bool> is_eos_;
+	std::mutex mutex_; // Only used to sleep/wake; the ring itself is lock-free
+	std::condition_variable cv_;
+	std::function<void()> on_frame_; // Guarded by mutex_
+	ThreadPolicy thread_policy_;
+	size_t thread_policy_index_ = 0;
+	std::thread thread_;
 private:
 	// Prevent copying
+	EyeCameraThreaded(const EyeCameraThreaded& other);
+	EyeCameraThreaded& operator=(const EyeCameraThreaded& rhs);
 };
 
+
 } // namespace
 #endif // IRIS_DETECTOR_IR_H
\ No newline at end of file
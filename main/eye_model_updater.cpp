@@ -1,4 +1,5 @@
 #include "eye_model_updater.h"
+#include "task_scheduler.h"
 
 namespace eye_tracker{
 
@@ -176,14 +177,22 @@ bool SpaceBinSearcher::search(int x, int y, cv::Vec2i &pt, float &dist){
 	}
 }
 
-EyeModelUpdater::EyeModelUpdater(){
+namespace {
+// Scores the RANSAC hypotheses of the model fit on the shared scheduler
+void parallel_for_shared(size_t n, const std::function<void(size_t i)> &body){
+	TaskScheduler::shared().parallel_for(n, body);
+}
+}
 
+EyeModelUpdater::EyeModelUpdater(){
+	simple_fitter_.parallel_for = parallel_for_shared;
 }
 
 EyeModelUpdater::EyeModelUpdater(double focal_length, double region_band_width, double region_step_epsilon)
 	: focal_length_(focal_length), simple_fitter_(focal_length_, region_band_width, region_step_epsilon),
 	fitter_max_count_(kFitterMaxCountDefault_)
 {
+	simple_fitter_.parallel_for = parallel_for_shared;
 }
 
 void EyeModelUpdater::add_fitter_max_count(int n){
@@ -206,7 +215,9 @@ bool EyeModelUpdater::add_observation(cv::Mat &image, sef::Ellipse2D<double> &pu
 		if (force||space_bin_searcher_.search(
 			(int)(pupil.centre.x() + image.cols / 2), 
 			(int)(pupil.centre.y() + image.rows / 2), pt, dist)){
-			simple_fitter_.add_observation(image, pupil, pupil_inliers);
+			// The fitter keeps the image for the contrast refinement; copy it so that a recycled
+			// capture buffer cannot overwrite it later
+			simple_fitter_.add_observation(image.clone(), pupil, pupil_inliers);
 			fitter_count_++;
 			if (fitter_count_ == fitter_max_count_){
 				simple_fitter_.unproject_observations();
@@ -219,7 +230,7 @@ bool EyeModelUpdater::add_observation(cv::Mat &image, sef::Ellipse2D<double> &pu
 	return is_added;
 }
 
-singleeyefitter::EyeModelFitter::Circle  EyeModelUpdater::unproject(cv::Mat &img, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts){
+singleeyefitter::EyeModelFitter::Circle  EyeModelUpdater::unproject(cv::Mat &img, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts) const{
 	if (simple_fitter_.eye){
 		// Unproject the current 2D ellipse observations
 		singleeyefitter::EyeModelFitter::Observation curr_obs(img, el, inlier_pts);
@@ -241,7 +252,7 @@ singleeyefitter::EyeModelFitter::Circle  EyeModelUpdater::unproject(cv::Mat &img
 }
 
 
-double EyeModelUpdater::compute_reliability(cv::Mat &img, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts){
+double EyeModelUpdater::compute_reliability(cv::Mat &img, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts) const{
 	double realiabiliy = 0.0;
 	if (simple_fitter_.eye){
 
@@ -271,6 +282,46 @@ double EyeModelUpdater::compute_reliability(cv::Mat &img, sef::Ellipse2D<double>
 	return realiabiliy;
 }
 
+GazeSample EyeModelUpdater::update(const FrameInfo &info, cv::Mat &img, bool is_pupil_found, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts,
+	double reliability_threshold, bool force){
+	if (is_model_built_) {
+		return estimate(info, img, is_pupil_found, el, inlier_pts, reliability_threshold);
+	}
+	GazeSample sample;
+	sample.frame = info;
+	sample.is_pupil_found = is_pupil_found;
+	sample.pupil = el;
+	if (is_pupil_found) {
+		sample.is_added = add_observation(img, el, inlier_pts, force);
+	}
+	sample.is_model_built = is_model_built_;
+	sample.eye = simple_fitter_.eye;
+	sample.result_time = Clock::now();
+	return sample;
+}
+
+GazeSample EyeModelUpdater::estimate(const FrameInfo &info, cv::Mat &img, bool is_pupil_found, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts,
+	double reliability_threshold) const{
+	GazeSample sample;
+	sample.frame = info;
+	sample.is_pupil_found = is_pupil_found;
+	sample.pupil = el;
+	if (is_pupil_found && is_model_built_) {
+		// Unproject the current 2D ellipse observation to a 3D disk
+		singleeyefitter::EyeModelFitter::Circle curr_circle = unproject(img, el, inlier_pts);
+		if (curr_circle && !isnan(curr_circle.normal(0, 0))){
+			singleeyefitter::Ellipse2D<double> pupil_el(sef::project(curr_circle, focal_length_));
+			sample.reliability = el.similarity(pupil_el);
+			sample.pupil_circle = curr_circle;
+		}
+		sample.is_reliable = (sample.reliability > reliability_threshold);
+	}
+	sample.is_model_built = is_model_built_;
+	sample.eye = simple_fitter_.eye;
+	sample.result_time = Clock::now();
+	return sample;
+}
+
 void EyeModelUpdater::render(cv::Mat &img, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts){
 
 	if (simple_fitter_.eye){
@@ -302,6 +353,30 @@ void EyeModelUpdater::render(cv::Mat &img, sef::Ellipse2D<double> &el, std::vect
 	}
 }
 
+void EyeModelUpdater::render(cv::Mat &img, const GazeSample &sample) const{
+	if (sample.eye && sample.pupil_circle && !isnan(sample.pupil_circle.normal(0, 0))){
+		const float displayscale = 1.0f;
+
+		// 3D eyeball
+		cv::RotatedRect rr_eye = eye_tracker::toImgCoord(sef::toRotatedRect(sef::project(sample.eye, focal_length_)), img, displayscale);
+		cv::ellipse(img, rr_eye, cv::Vec3b(255, 128, 0), 1, CV_AA);
+		cv::circle(img, rr_eye.center, 3, cv::Vec3b(255, 128, 0), 1); // Eyeball center projection
+
+		// 3D pupil
+		singleeyefitter::Ellipse2D<double> pupil_el(sef::project(sample.pupil_circle, focal_length_));
+		cv::RotatedRect rr_pupil = eye_tracker::toImgCoord(singleeyefitter::toRotatedRect(pupil_el), img, displayscale);
+		cv::ellipse(img, rr_pupil, cv::Vec3b(0, 255, 128), 1, CV_AA);
+		cv::line(img, rr_eye.center, rr_pupil.center, cv::Vec3b(255, 128, 0), 1, CV_AA);
+
+		// 3D gaze vector
+		singleeyefitter::EyeModelFitter::Circle c_end = sample.pupil_circle;
+		c_end.centre = sample.pupil_circle.centre + (10.0)*sample.pupil_circle.normal; // Unit: mm
+		singleeyefitter::Ellipse2D<double> e_end(sef::project(c_end, focal_length_));
+		cv::RotatedRect rr_end = eye_tracker::toImgCoord(singleeyefitter::toRotatedRect(e_end), img, displayscale);
+		cv::line(img, cv::Point(rr_pupil.center), cv::Point(rr_end.center), cv::Vec3b(0, 255, 128), 2, CV_AA);
+	}
+}
+
 void EyeModelUpdater::reset(){
 	simple_fitter_.reset();
 	space_bin_searcher_.reset_indices();
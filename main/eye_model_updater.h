@@ -9,7 +9,6 @@
 
 #include <Eigen/Core>
 #include <opencv2/core/core.hpp>
-#include <opencv2/highgui/highgui.hpp>
 #include <opencv2/flann/flann.hpp>
 
 
@@ -24,6 +23,7 @@
 
 
 //#include "eye_util.h"
+#include "frame.h"
 
 
 namespace eye_tracker{
@@ -75,6 +75,29 @@ protected:
 	std::vector<bool> taken_flags_;
 };
 
+/**
+* @brief Result of one tracking step. It keeps the capture record of the frame
+* it was computed from, so every gaze estimate can be traced back to its capture instant
+*/
+struct GazeSample
+{
+	FrameInfo frame;                 ///< Capture record of the source frame
+	bool is_pupil_found = false;     ///< A 2D pupil ellipse was detected
+	sef::Ellipse2D<double> pupil;    ///< 2D pupil ellipse, origin at the image centre
+	bool is_model_built = false;     ///< The 3D eye model was available for this frame
+	bool is_added = false;           ///< The 2D pupil was added as a model observation
+	double reliability = 0.0;        ///< Similarity of the 2D pupil and the reprojected 3D pupil
+	bool is_reliable = false;        ///< reliability exceeded the threshold
+	sef::Circle3D<double> pupil_circle = sef::Circle3D<double>::Null; ///< 3D pupil disk, its normal is the gaze vector [mm]
+	sef::Sphere<double> eye = sef::Sphere<double>::Null;              ///< 3D eyeball [mm]
+	Clock::time_point result_time;   ///< When the sample was produced
+
+	/// Capture-to-result latency in milliseconds
+	double latency_ms() const {
+		return std::chrono::duration<double, std::milli>(result_time - frame.capture_time).count();
+	}
+};
+
 // 3D eye model fitting
 class EyeModelUpdater
 {
@@ -84,11 +107,24 @@ public:
 
 	bool add_observation(cv::Mat &image, sef::Ellipse2D<double> &pupil, std::vector<cv::Point2f> &pupil_inliers, bool force=false);
 	
-	singleeyefitter::EyeModelFitter::Circle unproject(cv::Mat &img, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts);
+	singleeyefitter::EyeModelFitter::Circle unproject(cv::Mat &img, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts) const;
 	
-	double compute_reliability(cv::Mat &img, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts);
+	double compute_reliability(cv::Mat &img, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts) const;
+
+	/// Adds a detected pupil to the model while it is being built, or unprojects it to a 3D gaze once it is.
+	/// The returned sample carries the capture record of the frame
+	GazeSample update(const FrameInfo &info, cv::Mat &img, bool is_pupil_found, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts,
+		double reliability_threshold, bool force = false);
+
+	/// Unprojects a detected pupil with the built model without changing it. Several threads may call this
+	/// at the same time, as long as no thread calls update(), reset() or add_fitter_max_count() meanwhile
+	GazeSample estimate(const FrameInfo &info, cv::Mat &img, bool is_pupil_found, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts,
+		double reliability_threshold) const;
 
 	void render(cv::Mat &img, sef::Ellipse2D<double> &el, std::vector<cv::Point2f> &inlier_pts);
+	/// Draws the eyeball, pupil and gaze of a sample. Only the sample is used, not the model,
+	/// so this may run on another thread than update()
+	void render(cv::Mat &img, const GazeSample &sample) const;
 
 	void reset();
 
@@ -0,0 +1,49 @@
+#include "eye_tracker.h"
+
+#include "ubitrack_util.h"
+
+namespace eye_tracker
+{
+
+bool read_calibration(const std::string &calib_path, cv::Mat &K, cv::Vec<double, 8> &distCoeffs){
+	UbitrackTextReader<Caib> ubitrack_calib_text_reader;
+	if (ubitrack_calib_text_reader.read(calib_path) == false){
+		return false;
+	}
+	ubitrack_calib_text_reader.data_.get_parameters_opencv_default(K, distCoeffs);
+	return true;
+}
+
+namespace {
+/// Focal distance used in the 3D eye model fitter
+double focal_length_of(const cv::Mat &K){
+	if (K.rows != 3 || K.cols != 3 || K.type() != CV_64F){
+		throw "EyeTracker: K must be a 3x3 double camera matrix";
+	}
+	return (K.at<double>(0, 0) + K.at<double>(1, 1)) * 0.5;
+}
+}
+
+EyeTracker::EyeTracker(const EyeTrackerOptions &options)
+	: tracker_(std::make_unique<CameraUndistorter>(options.K, options.distCoeffs),
+		std::make_unique<EyeModelUpdater>(focal_length_of(options.K), options.region_band_width, options.region_step_epsilon),
+		options.tracking)
+{
+	tracker_.undistorter().setFixedPointMaps(options.is_fixed_point_maps);
+}
+
+GazeSample EyeTracker::process(const Frame &frame){
+	tracked_.frame = frame; // Shares the image, no copy
+	tracker_.process(tracked_);
+	return tracked_.sample;
+}
+
+GazeSample EyeTracker::process(const cv::Mat &image, Clock::time_point capture_time){
+	input_.image = image;
+	input_.info.capture_time = capture_time;
+	input_.info.format = toPixelFormat(image);
+	input_.info.sequence = sequence_++;
+	return process(input_);
+}
+
+} // namespace
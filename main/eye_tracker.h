@@ -0,0 +1,72 @@
+#ifndef EYE_TRACKER_H
+#define EYE_TRACKER_H
+
+#include <string>
+#include <cstdint>
+#include <opencv2/core/core.hpp>
+#include "frame.h"
+#include "camera_tracker.h"
+
+namespace eye_tracker
+{
+
+/// Settings of an EyeTracker
+struct EyeTrackerOptions {
+	cv::Mat K;                                                  ///< Camera intrinsic matrix
+	cv::Vec<double, 8> distCoeffs = cv::Vec<double, 8>::all(0); ///< Lens distortion (k1 k2 p1 p2 [k3 [k4 k5 k6]])
+	TrackingOptions tracking;                                   ///< Undistortion mode and gaze reliability threshold
+	double region_band_width = 5;                               ///< Contrast refinement of the eye model, see EyeModelUpdater
+	double region_step_epsilon = 0.5;                           ///< Contrast refinement of the eye model, see EyeModelUpdater
+	bool is_fixed_point_maps = true;                            ///< FULL_FRAME: undistort with fixed-point maps
+};
+
+/// Reads the camera matrix and distortion from a Ubitrack calibration text file. Returns false if it cannot be read
+bool read_calibration(const std::string &calib_path, cv::Mat &K, cv::Vec<double, 8> &distCoeffs);
+
+/**
+* @class EyeTracker
+* @brief 3D eye tracking of one camera behind a single process() call, for embedding in a host application.
+*
+* Configure once with the camera calibration, then pass every frame to
+* process() at the host's own cadence; it returns the 3D gaze of the frame.
+* The first frames with a pupil build the eye model, see isModelBuilt().
+* All intermediate images and point lists are kept between calls and reused.
+* The library opens no windows and does not depend on HighGUI.
+* process() must be called from one thread at a time; reset() and refit()
+* may be called from any thread and take effect at the next process().
+*/
+class EyeTracker
+{
+public:
+	/// Throws a const char* if options.K is not a 3x3 camera matrix
+	explicit EyeTracker(const EyeTrackerOptions &options);
+
+	/// Tracks one frame. Its capture record is carried into the result, e.g. for latency accounting
+	GazeSample process(const Frame &frame);
+	/// Tracks one BGR or single channel image grabbed at capture_time; images are numbered in call order
+	GazeSample process(const cv::Mat &image, Clock::time_point capture_time = Clock::now());
+
+	/// Discards the eye model; the next frames build a new one
+	void reset() { tracker_.requestReset(); }
+	/// Adds the pupils of the next n frames to the model and refits it
+	void refit(int n = 10) { tracker_.requestMoreObservations(n); }
+
+	bool isModelBuilt() { return tracker_.updater().is_model_built(); }
+	/// Everything computed for the last frame: the preprocessed image, the 2D pupil with its edge points and the 3D result
+	const TrackedFrame& lastResult() const { return tracked_; }
+	/// Draws the last frame and its results into a color image, without showing it
+	void render(cv::Mat &img_rgb_debug) { tracker_.render(tracked_, img_rgb_debug, true); }
+
+protected:
+	CameraTracker tracker_;
+	TrackedFrame tracked_; // Reused from frame to frame
+	Frame input_;          // Capture record of images passed without one
+	uint64_t sequence_ = 0;
+private:
+	// Prevent copying
+	EyeTracker(const EyeTracker& other);
+	EyeTracker& operator=(const EyeTracker& rhs);
+};
+
+} // namespace
+#endif // EYE_TRACKER_H
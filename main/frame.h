@@ -0,0 +1,57 @@
+#ifndef EYE_TRACKER_FRAME_H
+#define EYE_TRACKER_FRAME_H
+
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <opencv2/core/core.hpp>
+
+namespace eye_tracker
+{
+
+/// Monotonic clock used for all capture and result timestamps
+typedef std::chrono::steady_clock Clock;
+
+/// Pixel layout of a frame image
+enum class PixelFormat {
+	BGR8, ///< 3 channels, 8 bit, OpenCV's default BGR order
+	Y8    ///< 1 channel, 8 bit luminance (IR eye cameras)
+};
+
+inline PixelFormat toPixelFormat(const cv::Mat &image) {
+	return image.channels() == 1 ? PixelFormat::Y8 : PixelFormat::BGR8;
+}
+
+/// Elapsed time from t until now in milliseconds
+inline double millisecondsSince(const Clock::time_point &t) {
+	return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+}
+
+/**
+* @brief Capture record of a frame. Every image source fills it when the
+* frame is grabbed, and it is copied along with all results derived from it.
+*/
+struct FrameInfo {
+	Clock::time_point capture_time;         ///< Monotonic time at which the frame was grabbed
+	uint64_t sequence = 0;                  ///< Per-source frame counter, gaps mean dropped frames
+	int source_id = 0;                      ///< Camera index, e.g. 0/1 for the two eyes in stereo mode
+	PixelFormat format = PixelFormat::BGR8; ///< Layout of the image as delivered by the source
+};
+
+/**
+* @brief An image together with its capture record
+*/
+struct Frame {
+	cv::Mat image;
+	FrameInfo info;
+
+	bool empty() const { return image.empty(); }
+};
+
+inline void swap(Frame &a, Frame &b) {
+	cv::swap(a.image, b.image);
+	std::swap(a.info, b.info);
+}
+
+} // namespace
+#endif // EYE_TRACKER_FRAME_H
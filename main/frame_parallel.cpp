@@ -0,0 +1,67 @@
+#include "frame_parallel.h"
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "bounded_queue.h"
+#include "task_scheduler.h"
+
+namespace eye_tracker
+{
+
+FrameParallelStatistics track_frames_parallel(EyeCameraParent &source, CameraTracker &tracker, int threads,
+	const std::function<void(const TrackedFrame&)> &deliver){
+	if (threads < 1) threads = 1;
+	if (tracker.updater().is_model_built() == false){
+		throw "track_frames_parallel: the eye model is not built";
+	}
+	const size_t kBlockSize = 4 * threads;
+	BoundedQueue<TrackedFrame> decoded(2 * kBlockSize);
+
+	// Decodes ahead while a block is tracked and delivered
+	std::thread reader([&]() {
+		while (true){
+			TrackedFrame t;
+			source.fetchFrame(t.frame);
+			if (t.frame.empty()) break; // End of stream
+			if (decoded.push(std::move(t)) == false) break;
+		}
+		decoded.close();
+	});
+
+	FrameParallelStatistics stats;
+	std::vector<TrackedFrame> block(kBlockSize);
+	std::vector<PupilFitterWorkspace> workspaces(threads);
+	try{
+		bool is_eos = false;
+		while (is_eos == false){
+			size_t count = 0;
+			while (count < kBlockSize && decoded.pop(block[count])){
+				count++;
+			}
+			is_eos = (count < kBlockSize);
+
+			// Every share tracks the next frame of the block until none is left
+			std::atomic<size_t> next(0);
+			TaskScheduler::shared().parallel_for(threads, [&](size_t share) {
+				for (size_t i = next++; i < count; i = next++){
+					tracker.processWithModel(block[i], workspaces[share]);
+				}
+			});
+			for (size_t i = 0; i < count; i++){
+				deliver(block[i]);
+			}
+			stats.frames += count;
+			if (count > 0) stats.blocks++;
+		}
+	}
+	catch (...){
+		decoded.close();
+		reader.join();
+		throw;
+	}
+	reader.join();
+	return stats;
+}
+
+} // namespace
@@ -0,0 +1,35 @@
+#ifndef FRAME_PARALLEL_H
+#define FRAME_PARALLEL_H
+
+#include <functional>
+#include "eye_cameras.h"
+#include "camera_tracker.h"
+
+namespace eye_tracker
+{
+
+/// Counters of a frame-parallel run
+struct FrameParallelStatistics {
+	size_t frames = 0; ///< Frames tracked and delivered
+	size_t blocks = 0; ///< Blocks of frames tracked in parallel
+};
+
+/**
+Tracks the rest of a recording frame-parallel with an already built eye model.
+
+A reader thread decodes the frames ahead into a bounded queue. The calling
+thread takes them in blocks of a few frames per thread and tracks each block
+on the shared TaskScheduler (CameraTracker::processWithModel, one detector
+workspace per thread), then hands the results to deliver() in frame order.
+The model is not updated, so this suits offline recordings once the model
+is built; build it with the first frames first.
+@param source image source, read on the reader thread until the end of the stream
+@param tracker tracker of the source, with a built eye model
+@param threads number of frames tracked at the same time
+@param deliver called with every result in frame order
+*/
+FrameParallelStatistics track_frames_parallel(EyeCameraParent &source, CameraTracker &tracker, int threads,
+	const std::function<void(const TrackedFrame&)> &deliver);
+
+} // namespace
+#endif // FRAME_PARALLEL_H
@@ -0,0 +1,144 @@
+#include "frame_pool.h"
+
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <iostream>
+
+namespace eye_tracker
+{
+
+FramePool::FramePool(size_t block_size, size_t max_cached_blocks, size_t min_pooled_size)
+	: block_size_(block_size), max_cached_blocks_(max_cached_blocks), min_pooled_size_(min_pooled_size),
+	hits_(0), misses_(0), bypassed_(0), in_use_(0)
+{
+	free_blocks_.reserve(max_cached_blocks_);
+}
+
+FramePool::~FramePool(){
+	if (cv::Mat::getDefaultAllocator() == this){
+		cv::Mat::setDefaultAllocator(nullptr);
+	}
+	if (in_use_ > 0){
+		std::cout << "FramePool: destroyed while " << in_use_ << " blocks are still in use" << std::endl;
+	}
+	for (auto block : free_blocks_){
+		aligned_free(block);
+	}
+}
+
+unsigned char* FramePool::aligned_malloc(size_t size){
+	// Over-allocate, align and keep the original pointer right in front of the aligned block
+	unsigned char* raw = static_cast<unsigned char*>(std::malloc(size + sizeof(void*) + kAlignment));
+	if (raw == nullptr){
+		throw std::bad_alloc();
+	}
+	uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + kAlignment - 1) & ~(uintptr_t)(kAlignment - 1);
+	reinterpret_cast<unsigned char**>(aligned)[-1] = raw;
+	return reinterpret_cast<unsigned char*>(aligned);
+}
+void FramePool::aligned_free(unsigned char* ptr){
+	if (ptr != nullptr){
+		std::free(reinterpret_cast<unsigned char**>(ptr)[-1]);
+	}
+}
+
+cv::UMatData* FramePool::allocate(int dims, const int* sizes, int type, void* data0, size_t* step, int /*flags*/, cv::UMatUsageFlags /*usageFlags*/) const
+{
+	// Same layout computation as OpenCV's standard allocator
+	size_t total = CV_ELEM_SIZE(type);
+	for (int i = dims - 1; i >= 0; i--){
+		if (step){
+			if (data0 && step[i] != CV_AUTOSTEP){
+				CV_Assert(total <= step[i]);
+				total = step[i];
+			}
+			else{
+				step[i] = total;
+			}
+		}
+		total *= sizes[i];
+	}
+
+	unsigned char* data = static_cast<unsigned char*>(data0);
+	if (data == nullptr){
+		if (total < min_pooled_size_ || total > block_size_){
+			data = static_cast<unsigned char*>(cv::fastMalloc(total));
+			bypassed_++;
+		}
+		else{
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (free_blocks_.empty() == false){
+					data = free_blocks_.back();
+					free_blocks_.pop_back();
+				}
+			}
+			if (data != nullptr){
+				hits_++;
+			}
+			else{
+				data = aligned_malloc(block_size_);
+				misses_++;
+			}
+			in_use_++;
+		}
+	}
+
+	cv::UMatData* u = new cv::UMatData(this);
+	u->data = u->origdata = data;
+	u->size = total;
+	if (data0){
+		u->flags |= cv::UMatData::USER_ALLOCATED;
+	}
+	return u;
+}
+
+bool FramePool::allocate(cv::UMatData* u, int /*accessflags*/, cv::UMatUsageFlags /*usageFlags*/) const
+{
+	return u != nullptr;
+}
+
+void FramePool::deallocate(cv::UMatData* u) const
+{
+	if (u == nullptr) return;
+	CV_Assert(u->urefcount == 0);
+	CV_Assert(u->refcount == 0);
+	if (!(u->flags & cv::UMatData::USER_ALLOCATED)){
+		if (u->size < min_pooled_size_ || u->size > block_size_){
+			cv::fastFree(u->origdata);
+		}
+		else{
+			in_use_--;
+			bool is_cached = false;
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (free_blocks_.size() < max_cached_blocks_){
+					free_blocks_.push_back(u->origdata);
+					is_cached = true;
+				}
+			}
+			if (is_cached == false){
+				aligned_free(u->origdata);
+			}
+		}
+		u->origdata = 0;
+	}
+	delete u;
+}
+
+FramePoolStatistics FramePool::statistics() const
+{
+	FramePoolStatistics stats;
+	stats.hits = hits_;
+	stats.misses = misses_;
+	stats.bypassed = bypassed_;
+	stats.in_use = in_use_;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stats.cached = free_blocks_.size();
+	}
+	return stats;
+}
+
+} // namespace
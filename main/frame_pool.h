@@ -0,0 +1,75 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+namespace eye_tracker
+{
+
+/// Allocation counters of a FramePool
+struct FramePoolStatistics {
+	size_t hits = 0;      ///< Requests served from a recycled block
+	size_t misses = 0;    ///< Requests that had to allocate a new block from the heap
+	size_t bypassed = 0;  ///< Requests outside the pooled size range, served by the heap
+	size_t in_use = 0;    ///< Pool blocks currently referenced by a cv::Mat
+	size_t cached = 0;    ///< Pool blocks waiting for reuse
+};
+
+/**
+* @class FramePool
+* @brief cv::MatAllocator that recycles fixed-size, 64-byte aligned image buffers.
+*
+* cv::Mat already reference counts its buffer; when the last reference goes
+* away OpenCV calls deallocate() and the block is put back on the free list
+* instead of being freed. Install it once with cv::Mat::setDefaultAllocator()
+* and every frame-sized image (capture, remap, cvtColor, clone, ...) is drawn
+* from the pool, so steady-state processing does no large heap allocations.
+* Small matrices (kernels, point lists) and anything larger than a block go
+* straight to the heap.
+*/
+class FramePool : public cv::MatAllocator
+{
+public:
+	static const size_t kAlignment = 64;
+
+	/**
+	@param block_size size of every pooled block in bytes, e.g. the biggest frame (640*480*3)
+	@param max_cached_blocks number of free blocks kept for reuse; extra blocks are released
+	@param min_pooled_size requests smaller than this bypass the pool
+	*/
+	FramePool(size_t block_size, size_t max_cached_blocks = 32, size_t min_pooled_size = 16 * 1024);
+	~FramePool();
+
+	cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, int flags, cv::UMatUsageFlags usageFlags) const;
+	bool allocate(cv::UMatData* data, int accessflags, cv::UMatUsageFlags usageFlags) const;
+	void deallocate(cv::UMatData* data) const;
+
+	size_t block_size() const { return block_size_; }
+	FramePoolStatistics statistics() const;
+
+protected:
+	static unsigned char* aligned_malloc(size_t size);
+	static void aligned_free(unsigned char* ptr);
+
+	const size_t block_size_;
+	const size_t max_cached_blocks_;
+	const size_t min_pooled_size_;
+
+	mutable std::mutex mutex_;
+	mutable std::vector<unsigned char*> free_blocks_;
+	mutable std::atomic<size_t> hits_;
+	mutable std::atomic<size_t> misses_;
+	mutable std::atomic<size_t> bypassed_;
+	mutable std::atomic<size_t> in_use_;
+
+private:
+	// Prevent copying
+	FramePool(const FramePool& other);
+	FramePool& operator=(const FramePool& rhs);
+};
+
+} // namespace
+#endif // FRAME_POOL_H
@@ -0,0 +1,149 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include <utility>
+
+namespace eye_tracker
+{
+
+/// How a consumer of a FrameRing wants to receive frames
+enum class FramePolicy {
+	EVERY_FRAME,  ///< Deliver frames in capture order; the producer drops new frames when the ring is full
+	LATEST_FRAME  ///< Deliver only the newest frame; unread older frames are overwritten
+};
+
+/**
+* @class FrameRing
+* @brief Single-producer/single-consumer ring of preallocated frame slots.
+*
+* Both sides work on the slots in place (no copies, no locks). EVERY_FRAME uses
+* a classic bounded ring with one reserved slot. LATEST_FRAME uses three slots
+* as a triple buffer: the producer always has a free back slot, so it never
+* waits and never drops, and the consumer always gets the freshest frame.
+* All counters are updated with relaxed atomics and can be read from any thread.
+*/
+template<typename T>
+class FrameRing
+{
+public:
+	FrameRing(FramePolicy policy, size_t capacity = 8)
+		: policy_(policy),
+		slots_(policy == FramePolicy::LATEST_FRAME ? 3 : (capacity < 2 ? 2 : capacity)),
+		head_(0), tail_(0), back_(0), middle_(1), front_(2),
+		pushed_(0), popped_(0), dropped_(0), overwritten_(0)
+	{
+	}
+
+	/// Calls init(slot) on every slot, e.g. to allocate image buffers before capture starts
+	template<typename F>
+	void preallocate(F init) {
+		for (auto &slot : slots_) init(slot);
+	}
+
+	FramePolicy policy() const { return policy_; }
+	size_t capacity() const { return slots_.size(); }
+
+	// Producer side //////////////////////////////////////////////////
+
+	/// Returns the slot to write the next frame into, or nullptr if the ring is full (EVERY_FRAME only)
+	T* acquire_write() {
+		if (policy_ == FramePolicy::LATEST_FRAME) {
+			return &slots_[back_];
+		}
+		const size_t h = head_.load(std::memory_order_relaxed);
+		if (h - tail_.load(std::memory_order_acquire) >= slots_.size() - 1) {
+			return nullptr;
+		}
+		return &slots_[h % slots_.size()];
+	}
+	/// Publishes the slot returned by acquire_write()
+	void commit_write() {
+		if (policy_ == FramePolicy::LATEST_FRAME) {
+			const unsigned int prev = middle_.exchange(back_ | kFreshBit, std::memory_order_acq_rel);
+			if (prev & kFreshBit) {
+				overwritten_.fetch_add(1, std::memory_order_relaxed);
+			}
+			back_ = prev & kIndexMask;
+		}
+		else {
+			head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+		pushed_.fetch_add(1, std::memory_order_relaxed);
+	}
+	/// Records a frame the producer had to discard because acquire_write() failed
+	void count_drop() {
+		dropped_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Consumer side //////////////////////////////////////////////////
+
+	/// True if acquire_read() would return a frame
+	bool readable() const {
+		if (policy_ == FramePolicy::LATEST_FRAME) {
+			return (middle_.load(std::memory_order_acquire) & kFreshBit) != 0;
+		}
+		return head_.load(std::memory_order_acquire) != tail_.load(std::memory_order_relaxed);
+	}
+	/// Returns the next slot to read, or nullptr if nothing new was published.
+	/// The slot stays owned by the consumer until release_read().
+	T* acquire_read() {
+		if (policy_ == FramePolicy::LATEST_FRAME) {
+			if ((middle_.load(std::memory_order_acquire) & kFreshBit) == 0) {
+				return nullptr;
+			}
+			front_ = middle_.exchange(front_, std::memory_order_acq_rel) & kIndexMask;
+			return &slots_[front_];
+		}
+		const size_t t = tail_.load(std::memory_order_relaxed);
+		if (head_.load(std::memory_order_acquire) == t) {
+			return nullptr;
+		}
+		return &slots_[t % slots_.size()];
+	}
+	/// Hands the slot returned by acquire_read() back to the producer
+	void release_read() {
+		if (policy_ == FramePolicy::EVERY_FRAME) {
+			tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+		popped_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Statistics /////////////////////////////////////////////////////
+
+	size_t pushed() const { return pushed_.load(std::memory_order_relaxed); }           ///< Frames published by the producer
+	size_t popped() const { return popped_.load(std::memory_order_relaxed); }           ///< Frames handed to the consumer
+	size_t dropped() const { return dropped_.load(std::memory_order_relaxed); }         ///< Frames lost because the ring was full
+	size_t overwritten() const { return overwritten_.load(std::memory_order_relaxed); } ///< Frames replaced before the consumer read them
+
+private:
+	static const unsigned int kFreshBit = 0x4;
+	static const unsigned int kIndexMask = 0x3;
+
+	const FramePolicy policy_;
+	std::vector<T> slots_;
+
+	// EVERY_FRAME: monotonically increasing write/read counters
+	std::atomic<size_t> head_;
+	std::atomic<size_t> tail_;
+
+	// LATEST_FRAME: triple buffer indices. back_ is owned by the producer,
+	// front_ by the consumer, middle_ is exchanged between them.
+	unsigned int back_;
+	std::atomic<unsigned int> middle_;
+	unsigned int front_;
+
+	std::atomic<size_t> pushed_;
+	std::atomic<size_t> popped_;
+	std::atomic<size_t> dropped_;
+	std::atomic<size_t> overwritten_;
+
+	// Prevent copying
+	FrameRing(const FrameRing& other);
+	FrameRing& operator=(const FrameRing& rhs);
+};
+
+} // namespace
+#endif // FRAME_RING_H
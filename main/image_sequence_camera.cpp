@@ -0,0 +1,138 @@
+#include "image_sequence_camera.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <boost/filesystem.hpp>
+
+namespace eye_tracker
+{
+namespace fs = boost::filesystem;
+
+namespace {
+/// Number at the end of a file stem, e.g. 42 for "cam0_000042"; -1 if there is none
+long long trailingNumber(const std::string &stem){
+	size_t begin = stem.size();
+	while (begin > 0 && isdigit(static_cast<unsigned char>(stem[begin - 1]))) begin--;
+	if (begin == stem.size()) return -1;
+	return std::stoll(stem.substr(begin));
+}
+}
+
+EyeCameraImageSequence::EyeCameraImageSequence(const std::string &directory, const std::string &prefix, const std::string &extension,
+	int decoder_threads, size_t prefetch)
+	: decoder_threads_(decoder_threads < 1 ? 1 : decoder_threads), slots_(prefetch < 2 ? 2 : prefetch)
+{
+	std::cout << "EyeCameraImageSequence: Open an image sequence: " << directory << prefix << "*" << extension << std::endl;
+	try{
+		if (fs::is_directory(directory) == false){
+			throw "EyeCameraImageSequence: directory open error";
+		}
+		std::vector<std::pair<long long, std::string>> numbered;
+		for (fs::directory_iterator it(directory), end; it != end; ++it){
+			const fs::path &path = it->path();
+			const std::string stem = path.stem().string();
+			if (fs::is_regular_file(path) && path.extension().string() == extension && stem.compare(0, prefix.size(), prefix) == 0){
+				numbered.emplace_back(trailingNumber(stem), path.string());
+			}
+		}
+		if (numbered.empty()){
+			throw "EyeCameraImageSequence: no images found";
+		}
+		// Numeric order, so that cam0_1000 follows cam0_999 whatever the padding
+		std::sort(numbered.begin(), numbered.end());
+		for (const auto &n : numbered){
+			files_.push_back(n.second);
+		}
+	}
+	catch (const char *c){
+		std::cout << c << std::endl;
+		throw;
+	}
+	std::cout << "EyeCameraImageSequence: " << files_.size() << " images, " << decoder_threads_ << " decoder threads" << std::endl;
+}
+
+EyeCameraImageSequence::~EyeCameraImageSequence(){
+	stop();
+}
+
+void EyeCameraImageSequence::start(){
+	imread_flags_ = (pixel_format_ == PixelFormat::Y8) ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR;
+	next_decode_ = next_frame_;
+	for (auto &slot : slots_){
+		slot.is_ready = false;
+	}
+	is_running_ = true;
+	for (int i = 0; i < decoder_threads_; i++){
+		threads_.emplace_back(&EyeCameraImageSequence::decode_loop, this);
+	}
+}
+
+void EyeCameraImageSequence::stop(){
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		is_running_ = false;
+	}
+	consumed_cv_.notify_all();
+	for (auto &t : threads_){
+		if (t.joinable()) t.join();
+	}
+	threads_.clear();
+}
+
+void EyeCameraImageSequence::setPixelFormat(PixelFormat format){
+	if (format == pixel_format_) return;
+	const bool was_running = (threads_.empty() == false);
+	stop(); // Prefetched frames have the old format
+	pixel_format_ = format;
+	if (was_running) start();
+}
+
+void EyeCameraImageSequence::decode_loop(){
+	while (true){
+		size_t index;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			// Stay within the prefetch window of the consumer
+			consumed_cv_.wait(lock, [this]{ return is_running_ == false || next_decode_ < next_frame_ + slots_.size(); });
+			if (is_running_ == false || next_decode_ >= files_.size()) return;
+			index = next_decode_++;
+		}
+		// Decode outside the lock; the slot is owned by this thread until it is marked ready
+		cv::Mat image = cv::imread(files_[index], imread_flags_);
+		if (image.empty()){
+			std::cout << "EyeCameraImageSequence: could not read " << files_[index] << std::endl;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			Slot &slot = slots_[index % slots_.size()];
+			slot.image = image;
+			slot.index = index;
+			slot.is_ready = true;
+		}
+		decoded_cv_.notify_all();
+	}
+}
+
+void EyeCameraImageSequence::fetchFrame(Frame &frame){
+	if (next_frame_ >= files_.size()){
+		frame.image.release(); // End of stream
+		return;
+	}
+	if (threads_.empty()){
+		start();
+	}
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		Slot &slot = slots_[next_frame_ % slots_.size()];
+		decoded_cv_.wait(lock, [&]{ return slot.is_ready && slot.index == next_frame_; });
+		cv::swap(frame.image, slot.image);
+		slot.image.release();
+		slot.is_ready = false;
+		next_frame_++;
+	}
+	consumed_cv_.notify_all();
+	stampFrame(frame);
+}
+
+} // namespace
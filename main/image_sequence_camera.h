@@ -0,0 +1,71 @@
+#ifndef IMAGE_SEQUENCE_CAMERA_H
+#define IMAGE_SEQUENCE_CAMERA_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "eye_cameras.h"
+
+namespace eye_tracker
+{
+
+/**
+* @class EyeCameraImageSequence
+* @brief Replays a numbered image sequence (e.g. cam0_000042.png) in order.
+*
+* A few decoder threads read and decode the images ahead of the consumer into
+* a window of prefetch slots, so replay runs at the combined speed of all
+* decoders. Y8 images are decoded straight to grayscale. Decoding starts with
+* the first fetchFrame(); setPixelFormat() afterwards restarts the prefetch.
+*/
+class EyeCameraImageSequence : public EyeCameraParent
+{
+public:
+	/**
+	@param directory directory holding the images
+	@param prefix only files starting with this are used, e.g. "cam0_"
+	@param extension image file extension
+	@param decoder_threads number of threads decoding in parallel
+	@param prefetch number of frames decoded ahead of the consumer
+	*/
+	EyeCameraImageSequence(const std::string &directory, const std::string &prefix = "", const std::string &extension = ".png",
+		int decoder_threads = 2, size_t prefetch = 8);
+	~EyeCameraImageSequence();
+
+	bool isOpened() { return files_.empty() == false; }
+	void fetchFrame(Frame &frame);
+	void setPixelFormat(PixelFormat format);
+	size_t frameCount() const { return files_.size(); }
+
+protected:
+	struct Slot {
+		cv::Mat image;
+		size_t index = 0;
+		bool is_ready = false;
+	};
+
+	void start();
+	void stop();
+	void decode_loop();
+
+	std::vector<std::string> files_; // Sorted by frame number
+	const int decoder_threads_;
+	std::vector<Slot> slots_;        // Frame i is decoded into slots_[i % slots_.size()]
+	size_t next_frame_ = 0;          // Next frame handed to the consumer
+	size_t next_decode_ = 0;         // Next frame claimed by a decoder
+	int imread_flags_ = cv::IMREAD_COLOR;
+	bool is_running_ = false;
+	std::mutex mutex_;
+	std::condition_variable decoded_cv_;  // A slot became ready
+	std::condition_variable consumed_cv_; // A slot became free
+	std::vector<std::thread> threads_;
+private:
+	// Prevent copying
+	EyeCameraImageSequence(const EyeCameraImageSequence& other);
+	EyeCameraImageSequence& operator=(const EyeCameraImageSequence& rhs);
+};
+
+} // namespace
+#endif // IMAGE_SEQUENCE_CAMERA_H
@@ -0,0 +1,69 @@
+#include "loop_statistics.h"
+
+#include <cmath>
+
+namespace eye_tracker
+{
+
+LoopStatistics::LoopStatistics(size_t cameras, double interval_seconds)
+	: interval_seconds_(interval_seconds), interval_start_(Clock::now()), current_(cameras), last_(cameras)
+{
+}
+
+void LoopStatistics::add(size_t cam, const GazeSample &sample){
+	Accumulator &acc = current_[cam];
+	const uint64_t sequence = sample.frame.sequence;
+	if (acc.has_sequence == false){
+		acc.first_sequence = sequence;
+		acc.last_sequence = sequence;
+		acc.has_sequence = true;
+	}
+	else if (sequence > acc.last_sequence){
+		acc.last_sequence = sequence;
+	}
+	acc.processed++;
+	const double latency_ms = sample.latency_ms();
+	acc.latency_sum_ms += latency_ms;
+	acc.latency_sq_sum_ms += latency_ms * latency_ms;
+	if (latency_ms > acc.latency_max_ms) acc.latency_max_ms = latency_ms;
+}
+
+bool LoopStatistics::update(){
+	const double seconds = millisecondsSince(interval_start_) / 1000.0;
+	if (seconds < interval_seconds_){
+		return false;
+	}
+	interval_start_ = Clock::now();
+	for (size_t cam = 0; cam < current_.size(); cam++){
+		Accumulator &acc = current_[cam];
+		IntervalStatistics &stats = last_[cam];
+		stats.seconds = seconds;
+		stats.processed = acc.processed;
+		stats.captured = acc.has_sequence ? static_cast<size_t>(acc.last_sequence - acc.first_sequence + 1) : 0;
+		stats.dropped = (stats.captured > stats.processed) ? stats.captured - stats.processed : 0;
+		stats.latency_mean_ms = acc.processed > 0 ? acc.latency_sum_ms / acc.processed : 0;
+		stats.latency_max_ms = acc.latency_max_ms;
+		const double variance = acc.processed > 0 ? acc.latency_sq_sum_ms / acc.processed - stats.latency_mean_ms * stats.latency_mean_ms : 0;
+		stats.latency_jitter_ms = variance > 0 ? std::sqrt(variance) : 0;
+
+		// The next interval starts right after the newest frame of this one
+		const bool has_sequence = acc.has_sequence;
+		const uint64_t next_sequence = acc.last_sequence + 1;
+		acc = Accumulator();
+		if (has_sequence){
+			acc.first_sequence = next_sequence;
+			acc.last_sequence = next_sequence - 1;
+			acc.has_sequence = true;
+		}
+	}
+	return true;
+}
+
+std::ostream& operator<<(std::ostream &os, const IntervalStatistics &stats){
+	const double s = stats.seconds > 0 ? stats.seconds : 1;
+	return os << "captured=" << stats.captured / s << "/s, processed=" << stats.processed / s
+		<< "/s, dropped=" << stats.dropped / s << "/s, capture-to-result latency mean=" << stats.latency_mean_ms
+		<< " ms, max=" << stats.latency_max_ms << " ms, jitter=" << stats.latency_jitter_ms << " ms";
+}
+
+} // namespace
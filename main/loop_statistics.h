@@ -0,0 +1,69 @@
+#ifndef LOOP_STATISTICS_H
+#define LOOP_STATISTICS_H
+
+#include <vector>
+#include <ostream>
+#include "frame.h"
+#include "eye_model_updater.h"
+
+namespace eye_tracker
+{
+
+/// Frame counts and latency of one camera over one reporting interval
+struct IntervalStatistics {
+	double seconds = 0;       ///< Length of the interval
+	size_t captured = 0;      ///< Frames the source grabbed
+	size_t processed = 0;     ///< Frames that came out of the tracking loop
+	size_t dropped = 0;       ///< Frames skipped by the loop (gaps in the frame sequence)
+	double latency_mean_ms = 0; ///< Mean capture-to-result latency of the processed frames
+	double latency_max_ms = 0;  ///< Worst capture-to-result latency of the processed frames
+	double latency_jitter_ms = 0; ///< Standard deviation of the capture-to-result latency
+};
+
+/**
+* @class LoopStatistics
+* @brief Per-interval frame and latency accounting of the tracking loop.
+*
+* Every result passed to add() counts as processed; gaps in the per-source
+* frame sequence count as dropped, so the counts are correct for every source
+* and capture policy without asking the capture stage. A frame captured but
+* still waiting in a queue at the end of an interval is counted in the next one.
+*/
+class LoopStatistics
+{
+public:
+	/// @param interval_seconds length of a reporting interval
+	explicit LoopStatistics(size_t cameras, double interval_seconds = 1.0);
+
+	/// Counts one result of camera cam
+	void add(size_t cam, const GazeSample &sample);
+	/// Closes the interval once it has lasted interval_seconds; its counts are then in last().
+	/// Returns true if an interval was closed
+	bool update();
+	const std::vector<IntervalStatistics>& last() const { return last_; }
+
+protected:
+	struct Accumulator {
+		bool has_sequence = false;
+		uint64_t first_sequence = 0; // Sequence the interval starts at
+		uint64_t last_sequence = 0;  // Newest sequence seen
+		size_t processed = 0;
+		double latency_sum_ms = 0;
+		double latency_sq_sum_ms = 0; // Sum of squared latencies, for the jitter
+		double latency_max_ms = 0;
+	};
+
+	const double interval_seconds_;
+	Clock::time_point interval_start_;
+	std::vector<Accumulator> current_;
+	std::vector<IntervalStatistics> last_;
+private:
+	// Prevent copying
+	LoopStatistics(const LoopStatistics& other);
+	LoopStatistics& operator=(const LoopStatistics& rhs);
+};
+
+std::ostream& operator<<(std::ostream &os, const IntervalStatistics &stats);
+
+} // namespace
+#endif // LOOP_STATISTICS_H
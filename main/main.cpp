@@ -12,7 +12,6 @@
 #include <sstream>
 
 
-#include "ubitrack_util.h" // claibration file handlers
 #include <boost/foreach.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/path.hpp>
@@ -33,12 +32,26 @@
 
 #include "eye_model_updater.h" // 3D model builder
 #include "eye_cameras.h" // Camera interfaces
+#include "frame_pool.h" // Recycled image buffers
+#include "raw_video.h" // Memory-mapped raw eye videos
+#include "stream_recorder.h" // Background recording
+#include "synthetic_eye_camera.h" // Rendered eye images with ground truth
+#include "image_sequence_camera.h" // Prefetched image sequences
+#include "camera_tracker.h" // Per-camera tracking steps
+#include "eye_tracker.h" // Calibration file handlers
+#include "pipeline.h" // Threaded tracking stages
+#include "camera_workers.h" // Per-camera threads
+#include "batch_processing.h" // Headless processing of recordings
+#include "result_renderer.h" // Display on its own thread
+#include "loop_statistics.h" // Per-second frame and latency accounting
+#include "tracking_server.h" // Many headsets on shared worker threads
+#include "task_scheduler.h" // Work-stealing worker threads
 
 
  
 namespace {
 
-enum InputMode { CAMERA, CAMERA_MONO, VIDEO, IMAGE };
+enum InputMode { CAMERA, CAMERA_MONO, VIDEO, IMAGE, IMAGE_SEQUENCE, RAW_VIDEO, SYNTHETIC };
 
 }
 
@@ -48,22 +61,133 @@ int main(int argc, char *argv[]){
 	// Variables for FPS
 	eye_tracker::FrameRateCounter frame_rate_counter;
 
+	// Resolution and frame rate requested from the cameras, e.g. 1280x720 or 400x400 at 200 Hz for newer eye cameras.
+	// The 2D detector scales its parameters (tuned at 640x480) to the size of every frame
+	eye_tracker::CameraMode kCameraMode;
+	kCameraMode.size = cv::Size(640, 480);
+	kCameraMode.fps = 120;
+
+	// Draw every frame-sized image (capture, undistortion, conversion, debug copies) from a pool
+	// of recycled buffers, so the loop does no large heap allocations once it runs.
+	// The pool is declared first so that it outlives every image that uses it.
+	bool kPooledFrameBuffers = true;
+	const size_t kFrameBlockSize = kCameraMode.size.area() * 3; // Largest image the pool serves: one BGR frame of kCameraMode
+	eye_tracker::FramePool frame_pool(kFrameBlockSize);
+	if (kPooledFrameBuffers) {
+		cv::Mat::setDefaultAllocator(&frame_pool);
+	}
+
 	bool kVisualization = false;
 	kVisualization = true;
+	// Draw and show the results on a render thread at kDisplayRate instead of on every tracked frame.
+	// The tracking loop only publishes its results; results the display cannot keep up with are dropped
+	bool kRenderThread = true;
+	const double kDisplayRate = 60; // Redraws per second
+
+	// Deliver and process single channel 8 bit (Y8) images end to end. IR eye cameras are effectively
+	// monochrome, so converting once at ingest cuts the bytes moved through the loop to a third
+	bool kMonoPipeline = true;
+
+	// Grab frames on a dedicated thread per camera so that slow processing does not stall the cameras
+	bool kThreadedCapture = true;
+
+	// Low-latency mode for interactive use: track the newest frame of every live camera and drop the older ones,
+	// instead of working through a backlog of frames that are processed late. Every second the loop reports the
+	// captured, processed and dropped frames and the capture-to-result latency of each camera.
+	// Off: live cameras keep every frame in a bounded ring (EVERY_FRAME). Files are never dropped from
+	bool kLatestFrameMode = true;
+	if (kLatestFrameMode) {
+		kThreadedCapture = true; // Frames can only be skipped while a capture thread keeps grabbing them
+	}
+	const eye_tracker::FramePolicy kCapturePolicy = kLatestFrameMode ? eye_tracker::FramePolicy::LATEST_FRAME : eye_tracker::FramePolicy::EVERY_FRAME;
+
+	// Record the captured frames of every camera (./tmp/camN.avi) on background threads while tracking
+	bool kRecordSession = false;
+
+	// POINTS: run the 2D detection on the raw frame and undistort only the pupil ellipse and its edge points,
+	// instead of remapping every full frame. FULL_FRAME: undistort each frame before the detection.
+	const eye_tracker::UndistortMode kUndistortMode = eye_tracker::UndistortMode::POINTS;
+
+	// Run capture, preprocessing, 2D detection and 3D estimation as stages on their own threads, connected
+	// by bounded queues of kPipelineQueueDepth frames; the main loop becomes the output stage. Frames still
+	// come out in capture order, but throughput is set by the slowest stage instead of the sum of all stages
+	bool kPipelinedTracking = false;
+	const size_t kPipelineQueueDepth = kLatestFrameMode ? 1 : 2; // Frames waiting in the queues grow old
+
+	// Process the cameras of a stereo setup at the same time, each on its own thread, and join the results
+	// of every capture tick. Binocular tracking then takes about as long per frame as monocular tracking
+	bool kParallelCameras = true;
+
+	// Search the 2D pupil in a window around the pupil of the previous frame, moved on by its motion, and fall back
+	// to the whole frame when it is not found there (blinks, saccades). The hit rate is printed with the frame data
+	bool kTemporalTracking = true;
+
+	// Detect the 2D pupil of frames larger than 640x480 on a downscaled window and refine it at full resolution,
+	// so the detection costs about the same at every camera resolution
+	bool kCoarseToFine = true;
+
+	// Worker threads shared by all parallel work: cameras, batch recordings and frames, server sessions and
+	// the RANSAC of the model fit. 0 for one per core
+	const size_t kSchedulerThreads = 0;
+
+	// Keep the threads on fixed cores and out of reach of other processes, against migrations and preemptions
+	// that show up as latency spikes. Capture threads take kCaptureCores, the tracking threads (scheduler workers,
+	// pipeline stages and this loop) kTrackingCores; thread i of a group runs on cores[i % size], empty for any core.
+	// A priority of 1..99 requests SCHED_FIFO on Linux (needs CAP_SYS_NICE or an rtprio limit) and a raised
+	// thread priority on Windows, 0 keeps the default policy. What was granted is printed at startup
+	eye_tracker::ThreadPolicy kCaptureThreadPolicy;
+	kCaptureThreadPolicy.cores = {};
+	kCaptureThreadPolicy.priority = 0;
+	eye_tracker::ThreadPolicy kTrackingThreadPolicy;
+	kTrackingThreadPolicy.cores = {};
+	kTrackingThreadPolicy.priority = 0;
+	const bool is_thread_policy_set = kCaptureThreadPolicy.is_set() || kTrackingThreadPolicy.is_set();
+
+	eye_tracker::SchedulerOptions scheduler_options;
+	scheduler_options.workers = kSchedulerThreads;
+	scheduler_options.policy = kTrackingThreadPolicy;
+	eye_tracker::TaskScheduler::configure(scheduler_options);
 
 	InputMode input_mode =
 		//InputMode::VIDEO;  // Set a video as a video source
         // InputMode::CAMERA; // Set two cameras as video sources
 		 InputMode::CAMERA_MONO; // Set a camera as video sources
 	    // InputMode::IMAGE;// Set an image as a video source
+	    // InputMode::IMAGE_SEQUENCE;// Set a directory of numbered images (e.g. recorded cam0_000042.png) as a video source
+	    // InputMode::RAW_VIDEO;// Set a memory-mapped raw eye video (.eyeraw) as a video source
+	    // InputMode::SYNTHETIC;// Set a rendered eye with known gaze as a video source (benchmarks, accuracy checks)
+
+	// Convert the input video to a raw eye video next to it and exit; replaying that skips all decoding
+	const bool kConvertVideoToRaw = false;
 
 
 	////// Command line opitions /////////////
+	// Headless batch mode: main --batch [--out <directory>] <recording>...
+	// Tracks the recordings in parallel and writes <recording stem>.gaze.csv for each
+	const bool is_batch = (argc > 1 && std::string(argv[1]) == "--batch");
+	std::vector<std::string> batch_inputs;
+	std::string batch_output_directory;
+	for (int i = 2; is_batch && i < argc; i++) {
+		if (std::string(argv[i]) == "--out" && i + 1 < argc) {
+			batch_output_directory = argv[++i];
+		}
+		else {
+			batch_inputs.push_back(argv[i]);
+		}
+	}
+	// Tracking server: main --server <headset>... where a headset is a comma separated list of its cameras,
+	// each "cam:<index>", "ds:<DirectShow name>" or a recording. All headsets share one pool of worker threads
+	const bool is_server = (argc > 1 && std::string(argv[1]) == "--server");
+	std::vector<std::string> server_headsets;
+	for (int i = 2; is_server && i < argc; i++) {
+		server_headsets.push_back(argv[i]);
+	}
 	std::string kDir = "C:/Users/Yuta/Dropbox/work/Projects/20150427_Alex_EyeTracker/";
 	std::string media_file;
 	std::string media_file_stem;
+	std::string media_file_prefix;
 	//std::string kOutputDataDirectory(kDir + "out/");	// Data output directroy
-	if (argc > 2) {
+	if (argc > 2 && is_batch == false && is_server == false) {
 		boost::filesystem::path file_name = std::string(argv[2]);
 		kDir = std::string(argv[1]);
 		media_file_stem = file_name.stem().string();
@@ -72,26 +196,41 @@ int main(int argc, char *argv[]){
 		std::cout << "Load " << media_file << std::endl;
 		std::string media_file_ext = file_name.extension().string();
 
-		if (media_file_ext == ".avi" ||
+		if (boost::filesystem::is_directory(media_file)) {
+			// Optional third argument: file name prefix of the sequence, e.g. cam0_
+			input_mode = InputMode::IMAGE_SEQUENCE;
+			media_file_prefix = (argc > 3) ? std::string(argv[3]) : std::string();
+		}else if (media_file_ext == ".avi" ||
 			media_file_ext == ".mp4" ||
 			media_file_ext == ".wmv") {
 			input_mode = InputMode::VIDEO;
+		}else if (media_file_ext == eye_tracker::kRawVideoExtension) {
+			input_mode = InputMode::RAW_VIDEO;
 		}else{
 			input_mode = InputMode::IMAGE;
 		}
 	}
 	else {
-		if (input_mode == InputMode::IMAGE || input_mode == InputMode::VIDEO) {
+		if (input_mode == InputMode::IMAGE || input_mode == InputMode::IMAGE_SEQUENCE || input_mode == InputMode::VIDEO || input_mode == InputMode::RAW_VIDEO) {
 			switch (input_mode)
 			{
 			case InputMode::IMAGE:
 				media_file = kDir + "data3/test.png";
 				media_file_stem = "test";
 				break;
+			case InputMode::IMAGE_SEQUENCE:
+				media_file = "./tmp/";
+				media_file_prefix = "cam0_";
+				media_file_stem = "cam0";
+				break;
 			case InputMode::VIDEO:
 				media_file = kDir + "out/test.avi";
 				media_file_stem = "test";
 				break;
+			case InputMode::RAW_VIDEO:
+				media_file = kDir + "out/test" + eye_tracker::kRawVideoExtension;
+				media_file_stem = "test";
+				break;
 			default:
 				break;
 			}
@@ -99,28 +238,122 @@ int main(int argc, char *argv[]){
 	}
 	///////////////
 
+	if (kConvertVideoToRaw && input_mode == InputMode::VIDEO) {
+		boost::filesystem::path raw_file(media_file);
+		raw_file.replace_extension(eye_tracker::kRawVideoExtension);
+		return eye_tracker::convert_to_raw_video(media_file, raw_file.string()) ? 0 : -1;
+	}
+
 	
 	//// Camera intrinsic parameters
 	std::string calib_path="../../docs/cameraintrinsics_eye.txt";
-	eye_tracker::UbitrackTextReader<eye_tracker::Caib> ubitrack_calib_text_reader;
-	if (ubitrack_calib_text_reader.read(calib_path) == false){
+	cv::Mat K; // Camera intrinsic matrix in OpenCV format
+	cv::Vec<double, 8> distCoeffs; // (k1 k2 p1 p2 [k3 [k4 k5 k6]]) // k: radial, p: tangential
+	if (eye_tracker::read_calibration(calib_path, K, distCoeffs) == false){
 		std::cout << "Calibration file onpen error: " << calib_path << std::endl;
 		return -1;
 	}
-	cv::Mat K; // Camera intrinsic matrix in OpenCV format
-	cv::Vec<double, 8> distCoeffs; // (k1 k2 p1 p2 [k3 [k4 k5 k6]]) // k: radial, p: tangential
-	ubitrack_calib_text_reader.data_.get_parameters_opencv_default(K, distCoeffs);
+
+	// Compare the full-frame undistortion paths (float/fixed-point maps, fused gray conversion) and exit
+	const bool kBenchmarkUndistortion = false;
+	if (kBenchmarkUndistortion) {
+		eye_tracker::benchmark_undistortion(K, distCoeffs, kCameraMode.size);
+		return 0;
+	}
+
+	// Compare the sampled and the dense coarse pupil localisation on rendered eyes and exit
+	const bool kBenchmarkPupilLocalisation = false;
+	if (kBenchmarkPupilLocalisation) {
+		eye_tracker::EyeCameraSynthetic synthetic_camera;
+		std::vector<cv::Mat> images;
+		std::vector<cv::Point2f> pupil_centers;
+		for (int i = 0; i < 100; i++) {
+			eye_tracker::Frame frame;
+			synthetic_camera.fetchFrame(frame);
+			images.push_back(frame.image.clone());
+			pupil_centers.push_back(synthetic_camera.groundTruth(frame.info.sequence).pupil_rect.center);
+		}
+		eye_tracker::benchmark_pupil_localisation(images, pupil_centers);
+		return 0;
+	}
 
 	// Focal distance used in the 3D eye model fitter
 	double focal_length = (K.at<double>(0,0)+K.at<double>(1,1))*0.5; //  Required for the 3D model fitting
 
+	if (is_batch) {
+		eye_tracker::BatchOptions batch_options;
+		batch_options.K = K;
+		batch_options.distCoeffs = distCoeffs;
+		batch_options.tracking.undistort_mode = kUndistortMode;
+		batch_options.output_directory = batch_output_directory;
+		std::vector<eye_tracker::BatchResult> results = eye_tracker::run_batch(batch_inputs, batch_options);
+		for (const eye_tracker::BatchResult &r : results) {
+			if (r.is_ok == false) return -1;
+		}
+		return 0;
+	}
+
+	if (is_server) {
+		eye_tracker::TrackingOptions server_tracking_options;
+		server_tracking_options.undistort_mode = kUndistortMode;
+		// Ticks are dispatched from the capture threads to scheduler workers. On a single core the shared scheduler
+		// has none, so the server gets a worker of its own
+		std::unique_ptr<eye_tracker::TaskScheduler> server_scheduler;
+		if (eye_tracker::TaskScheduler::shared().workers() == 0) {
+			eye_tracker::SchedulerOptions server_scheduler_options;
+			server_scheduler_options.workers = 1;
+			server_scheduler_options.policy = kTrackingThreadPolicy;
+			server_scheduler = std::make_unique<eye_tracker::TaskScheduler>(server_scheduler_options);
+		}
+		std::unique_ptr<eye_tracker::TrackingServer> server;
+		try {
+			server = std::make_unique<eye_tracker::TrackingServer>(0,
+				server_scheduler ? *server_scheduler : eye_tracker::TaskScheduler::shared());
+			for (const std::string &headset : server_headsets) {
+				std::vector<std::unique_ptr<eye_tracker::EyeCameraParent>> sources;
+				std::vector<std::unique_ptr<eye_tracker::CameraTracker>> headset_trackers;
+				bool is_live = false;
+				std::stringstream specs(headset);
+				std::string spec;
+				while (std::getline(specs, spec, ',')) {
+					sources.push_back(eye_tracker::open_source(spec, is_live));
+					if (kMonoPipeline) {
+						sources.back()->setPixelFormat(eye_tracker::PixelFormat::Y8);
+					}
+					headset_trackers.push_back(std::make_unique<eye_tracker::CameraTracker>(
+						std::make_unique<eye_tracker::CameraUndistorter>(K, distCoeffs),
+						std::make_unique<eye_tracker::EyeModelUpdater>(focal_length, 5, 0.5), server_tracking_options));
+					headset_trackers.back()->undistorter().setFixedPointMaps(true);
+				}
+				server->addSession(headset, std::move(sources), is_live, std::move(headset_trackers));
+			}
+		}
+		catch (const char *c) {
+			std::cout << "Exception: " << c << std::endl;
+			return -1;
+		}
+		server->start();
+		bool is_ended = false;
+		while (is_ended == false) {
+			is_ended = server->waitFor(1.0);
+			for (const eye_tracker::SessionStatistics &stats : server->statistics()) {
+				std::cout << "  " << stats << std::endl;
+			}
+		}
+		server->stop();
+		return 0;
+	}
+
 	
 	// Set mode parameters
 	size_t kCameraNums;
 	switch (input_mode)
 	{
 	case InputMode::IMAGE:
+	case InputMode::IMAGE_SEQUENCE:
 	case InputMode::VIDEO:
+	case InputMode::RAW_VIDEO:
+	case InputMode::SYNTHETIC:
 	case InputMode::CAMERA_MONO:
 		kCameraNums = 1;
 		break;
@@ -137,12 +370,20 @@ int main(int argc, char *argv[]){
 	std::vector<std::unique_ptr<eye_tracker::EyeCameraParent>> eyecams(kCameraNums);                 // Image sources
 	std::vector<std::unique_ptr<eye_tracker::CameraUndistorter>> camera_undistorters(kCameraNums); // Camera undistorters
 	std::vector<std::string> window_names(kCameraNums);                                            // Window names
-	std::vector<cv::Mat> images(kCameraNums);                                                      // buffer images
+	std::vector<eye_tracker::TrackedFrame> tracked_frames(kCameraNums);                             // Latest frames and tracking results
 	std::vector<std::string> file_stems(kCameraNums);                                              // Output file stem names
 	std::vector<int> camera_indices(kCameraNums);                                                  // Camera indices for Opencv capture
 	std::vector<std::unique_ptr<eye_tracker::EyeModelUpdater>> eye_model_updaters(kCameraNums);    // 3D eye models
+	std::vector<std::unique_ptr<eye_tracker::CameraTracker>> trackers(kCameraNums);                // Tracking steps of each camera
+	std::vector<std::unique_ptr<eye_tracker::StreamRecorder>> recorders(kCameraNums);              // Session recorders
+	std::vector<eye_tracker::EyeCameraSynthetic*> synthetic_cameras(kCameraNums, nullptr);        // Ground truth of synthetic sources
+	std::vector<eye_tracker::TrackingErrorCounter> tracking_errors(kCameraNums);                  // Errors against the ground truth
+	std::vector<TemporalTrackingStatistics> search_statistics(kCameraNums);                       // How the pupils were searched
 
-	// Instantiate and initialize the class vectors
+	// What the thread policies achieved, printed once everything runs
+	std::vector<eye_tracker::ThreadPolicyResult> thread_policies;
+
+	// Instantiate and initialize the class vectors; opening a source or capturing its first frame may throw
 	try{
 		switch (input_mode)
 		{
@@ -160,13 +401,42 @@ int main(int argc, char *argv[]){
 			window_names = { "Video/Image" };
 			file_stems = { media_file_stem };
 			break;
+		case InputMode::IMAGE_SEQUENCE:
+			eyecams[0] = std::make_unique<eye_tracker::EyeCameraImageSequence>(media_file, media_file_prefix);
+			eye_model_updaters[0] = std::make_unique<eye_tracker::EyeModelUpdater>(focal_length, 5, 0.5);
+			camera_undistorters[0] = std::make_unique<eye_tracker::CameraUndistorter>(K, distCoeffs);
+			window_names = { "Video/Image" };
+			file_stems = { media_file_stem };
+			break;
+		case InputMode::RAW_VIDEO:
+			eyecams[0] = std::make_unique<eye_tracker::EyeCameraRaw>(media_file);
+			eye_model_updaters[0] = std::make_unique<eye_tracker::EyeModelUpdater>(focal_length, 5, 0.5);
+			camera_undistorters[0] = std::make_unique<eye_tracker::CameraUndistorter>(K, distCoeffs);
+			window_names = { "Video/Image" };
+			file_stems = { media_file_stem };
+			break;
+		case InputMode::SYNTHETIC:
+		{
+			eye_tracker::SyntheticEyeOptions options;
+			options.focal_length = focal_length;
+			options.is_paced = true;
+			auto synthetic_camera = std::make_unique<eye_tracker::EyeCameraSynthetic>(options);
+			synthetic_cameras[0] = synthetic_camera.get();
+			eyecams[0] = std::move(synthetic_camera);
+			eye_model_updaters[0] = std::make_unique<eye_tracker::EyeModelUpdater>(focal_length, 5, 0.5);
+			// Rendered images have no lens distortion
+			camera_undistorters[0] = std::make_unique<eye_tracker::CameraUndistorter>(K, cv::Vec<double, 8>::all(0));
+			window_names = { "Synthetic" };
+			file_stems = { "synthetic" };
+			break;
+		}
 		case InputMode::CAMERA:
 			camera_indices[0] = 0;
 			camera_indices[1] = 2;
 #if 0
 			// OpenCV HighGUI frame grabber
-			eyecams[0] = std::make_unique<eye_tracker::EyeCamera>(camera_indices[0], false);
-			eyecams[1] = std::make_unique<eye_tracker::EyeCamera>(camera_indices[1], false);
+			eyecams[0] = std::make_unique<eye_tracker::EyeCamera>(camera_indices[0], false, kCameraMode);
+			eyecams[1] = std::make_unique<eye_tracker::EyeCamera>(camera_indices[1], false, kCameraMode);
 #else
 			// DirectShow frame grabber
 			eyecams[0] = std::make_unique<eye_tracker::EyeCameraDS>("Pupil Cam1 ID0");
@@ -189,19 +459,118 @@ int main(int argc, char *argv[]){
 		default:
 			break;
 		}
+
+		for (size_t cam = 0; cam < kCameraNums; cam++) {
+			camera_undistorters[cam]->setFixedPointMaps(true);
+			eyecams[cam]->setSourceId(static_cast<int>(cam));
+			if (kMonoPipeline) {
+				eyecams[cam]->setPixelFormat(eye_tracker::PixelFormat::Y8);
+			}
+		}
+
+		// Move each image source behind its own capture thread
+		if (kThreadedCapture) {
+			const bool is_live = (input_mode == InputMode::CAMERA || input_mode == InputMode::CAMERA_MONO || input_mode == InputMode::SYNTHETIC);
+			const eye_tracker::FramePolicy policy = is_live ? kCapturePolicy : eye_tracker::FramePolicy::EVERY_FRAME;
+			for (size_t cam = 0; cam < kCameraNums; cam++) {
+				eyecams[cam] = std::make_unique<eye_tracker::EyeCameraThreaded>(std::move(eyecams[cam]), policy, 8, is_live);
+				if (kCaptureThreadPolicy.is_set()) {
+					thread_policies.push_back(static_cast<eye_tracker::EyeCameraThreaded*>(eyecams[cam].get())->setThreadPolicy(kCaptureThreadPolicy, cam));
+				}
+			}
+		}
 	}
-	catch (char *c){
+	catch (const char *c){
 		std::cout << "Exception: ";
 		std::cout << c << std::endl;
-		return 0;
+		return -1;
+	}
+
+	if (kRecordSession) {
+		for (size_t cam = 0; cam < kCameraNums; cam++) {
+			eye_tracker::RecorderOptions options;
+			options.stem = file_stems[cam];
+			recorders[cam] = std::make_unique<eye_tracker::StreamRecorder>(options);
+		}
 	}
 
 
-	////////////////////////
-	// 2D pupil detector
-	PupilFitter pupilFitter;
-	pupilFitter.setDebug(false);
-	/////////////////////////
+	// Tracking steps of each camera, with its own 2D pupil detector, undistorter and 3D eye model
+	eye_tracker::TrackingOptions tracking_options;
+	tracking_options.undistort_mode = kUndistortMode;
+	tracking_options.reliability_threshold = 0.8;// 0.96;
+	tracking_options.is_temporal_tracking = kTemporalTracking;
+	tracking_options.is_coarse_to_fine = kCoarseToFine;
+	for (size_t cam = 0; cam < kCameraNums; cam++) {
+		trackers[cam] = std::make_unique<eye_tracker::CameraTracker>(std::move(camera_undistorters[cam]), std::move(eye_model_updaters[cam]), tracking_options);
+	}
+
+	// Fetches one frame of every camera; false at the end of the stream
+	auto fetch_frames = [&](std::vector<eye_tracker::TrackedFrame> &tracked) {
+		bool is_eos = false;
+		for (size_t cam = 0; cam < kCameraNums; cam++) {
+			eyecams[cam]->fetchFrame(tracked[cam].frame);
+			if (tracked[cam].frame.empty()) {
+				is_eos = true;
+				continue;
+			}
+			if (kRecordSession) {
+				recorders[cam]->record(tracked[cam].frame);
+			}
+		}
+		return is_eos == false;
+	};
+
+	// Threads that run a tracking step for all cameras of a tick; one set for each pipeline stage
+	const size_t kCameraThreads = kParallelCameras ? kCameraNums : 1;
+	eye_tracker::CameraWorkers camera_workers(kCameraThreads);
+	eye_tracker::CameraWorkers detect_workers(kPipelinedTracking ? kCameraThreads : 1);
+	eye_tracker::CameraWorkers estimate_workers(kPipelinedTracking ? kCameraThreads : 1);
+
+	eye_tracker::Pipeline<std::vector<eye_tracker::TrackedFrame>> pipeline(kPipelineQueueDepth);
+	if (kPipelinedTracking) {
+		pipeline.setSource("Capture", [&](std::vector<eye_tracker::TrackedFrame> &tracked) {
+			tracked.resize(kCameraNums);
+			return fetch_frames(tracked);
+		});
+		pipeline.addStage("Preprocess", [&](std::vector<eye_tracker::TrackedFrame> &tracked) {
+			camera_workers.run(kCameraNums, [&](size_t cam) { trackers[cam]->preprocess(tracked[cam]); });
+		});
+		pipeline.addStage("Detect 2D", [&](std::vector<eye_tracker::TrackedFrame> &tracked) {
+			detect_workers.run(kCameraNums, [&](size_t cam) { trackers[cam]->detect(tracked[cam]); });
+		});
+		pipeline.addStage("Estimate 3D", [&](std::vector<eye_tracker::TrackedFrame> &tracked) {
+			estimate_workers.run(kCameraNums, [&](size_t cam) { trackers[cam]->estimate(tracked[cam]); });
+		});
+		pipeline.setOutputName("Output");
+		pipeline.setThreadPolicy(kCaptureThreadPolicy, kTrackingThreadPolicy);
+		pipeline.start();
+		thread_policies.insert(thread_policies.end(), pipeline.threadPolicies().begin(), pipeline.threadPolicies().end());
+	}
+
+	std::unique_ptr<eye_tracker::ResultRenderer> renderer;
+	if (kVisualization && kRenderThread) {
+		std::vector<eye_tracker::CameraTracker*> rendered_trackers;
+		for (auto &tracker : trackers) {
+			rendered_trackers.push_back(tracker.get());
+		}
+		renderer = std::make_unique<eye_tracker::ResultRenderer>(rendered_trackers, window_names, kDisplayRate);
+	}
+
+	if (is_thread_policy_set) {
+		// This loop tracks too; it takes the core after the workers'
+		const std::vector<eye_tracker::ThreadPolicyResult> &worker_policies = eye_tracker::TaskScheduler::shared().thread_policies();
+		thread_policies.insert(thread_policies.end(), worker_policies.begin(), worker_policies.end());
+		if (kTrackingThreadPolicy.is_set()) {
+			thread_policies.push_back(eye_tracker::apply_current_thread_policy("Main loop", kTrackingThreadPolicy, eye_tracker::TaskScheduler::shared().workers()));
+		}
+		std::cout << "Thread policies:" << std::endl;
+		for (const eye_tracker::ThreadPolicyResult &result : thread_policies) {
+			std::cout << "  " << result << std::endl;
+		}
+	}
+
+	eye_tracker::LoopStatistics loop_statistics(kCameraNums, 1.0);
 
 	// Main loop
 	const char kTerminate = 27;//Escape 0x1b
@@ -210,7 +579,10 @@ int main(int argc, char *argv[]){
 
 		// Fetch key input
 		char kKEY = 0;
-		if (kVisualization) {
+		if (renderer) {
+			kKEY = renderer->takeKey(); // HighGUI belongs to the render thread
+		}
+		else if (kVisualization) {
 			kKEY = cv::waitKey(1);
 		}
 		switch (kKEY) {
@@ -220,97 +592,120 @@ int main(int argc, char *argv[]){
 		}
 
 		// Fetch images
-		for (size_t cam = 0; cam < kCameraNums; cam++) {
-			eyecams[cam]->fetchFrame(images[cam]);
+		bool is_frame_available;
+		if (kPipelinedTracking) {
+			// Frames that went through all stages
+			is_frame_available = pipeline.pop(tracked_frames);
+			if (is_frame_available == false) {
+				break; // End of stream
+			}
 		}
-		// Process each camera images
-		for (size_t cam = 0; cam < kCameraNums; cam++) {
-			cv::Mat &img = images[cam];
-			if (img.empty()) {
-				//is_run = false;
-				break;
+		else {
+			is_frame_available = fetch_frames(tracked_frames);
+			if (is_frame_available) {
+				// 2D pupil detection and 3D eye pose estimation of all cameras
+				camera_workers.run(kCameraNums, [&](size_t cam) { trackers[cam]->process(tracked_frames[cam]); });
 			}
-
-			// Undistort a captured image
-			camera_undistorters[cam]->undistort(img, img);
-
-			cv::Mat img_rgb_debug = img.clone();
-			cv::Mat img_grey;
+		}
+		// Results of each camera
+		for (size_t cam = 0; cam < kCameraNums && is_frame_available; cam++) {
+			eye_tracker::TrackedFrame &tracked = tracked_frames[cam];
 
 			switch (kKEY) {
 			case 'r':
-				eye_model_updaters[cam]->reset();
+				trackers[cam]->requestReset();
 				break;
 			case 'p':
-				eye_model_updaters[cam]->add_fitter_max_count(10);
+				trackers[cam]->requestMoreObservations(10);
 				break;
 			default:
 				break;
 			}
 
-			// 2D ellipse detection
-			std::vector<cv::Point2f> inlier_pts;
-			cv::cvtColor(img, img_grey, CV_RGB2GRAY);
-			cv::RotatedRect rr_pf;
-			bool is_pupil_found = pupilFitter.pupilAreaFitRR(img_grey, rr_pf, inlier_pts);
-
-			singleeyefitter::Ellipse2D<double> el = singleeyefitter::toEllipse<double>(eye_tracker::toImgCoordInv(rr_pf, img, 1.0));
-
-			// 3D eye pose estimation
-			bool is_reliable = false;
-			bool is_added = false;
-			const bool force_add = false;
-			const double kReliabilityThreshold = 0.8;// 0.96;
-			double ellipse_realiability = 0.0; /// Reliability of a detected 2D ellipse based on 3D eye model
-			if (is_pupil_found) {
-				if (eye_model_updaters[cam]->is_model_built()) {
-					ellipse_realiability = eye_model_updaters[cam]->compute_reliability(img, el, inlier_pts);
-					is_reliable = (ellipse_realiability > kReliabilityThreshold);
-					//					is_reliable = true;
-				}
-				else {
-					is_added = eye_model_updaters[cam]->add_observation(img_grey, el, inlier_pts, force_add);
-				}
+			eye_tracker::GazeSample &sample = tracked.sample;
+			loop_statistics.add(cam, sample);
+			search_statistics[cam].add(tracked.detection);
 
+			// Compare with the ground truth of synthetic frames
+			if (synthetic_cameras[cam] != nullptr) {
+				tracking_errors[cam].add(sample, tracked.detection.rect, synthetic_cameras[cam]->groundTruth(sample.frame.sequence));
 			}
 
 			// Visualize results
-			if (cam == 0 && kVisualization) {
-
-				// 2D pupil
-				if (is_pupil_found) {
-					cv::ellipse(img_rgb_debug, rr_pf, cv::Vec3b(255, 128, 0), 1);
-				}
-
-				// 3D eye ball
-				if (eye_model_updaters[cam]->is_model_built()) {
-					cv::putText(img, "Reliability: " + std::to_string(ellipse_realiability), cv::Point(30, 440), cv::FONT_HERSHEY_SIMPLEX, 1.0, cv::Scalar(0, 128, 255), 1);
-					if (is_reliable) {
-						eye_model_updaters[cam]->render(img_rgb_debug, el, inlier_pts);
-					}
-				}else{
-					eye_model_updaters[cam]->render_status(img_rgb_debug);
-					cv::putText(img, "Sample #: " + std::to_string(eye_model_updaters[cam]->fitter_count()) + "/" + std::to_string(eye_model_updaters[cam]->fitter_end_count()),
-						cv::Point(30, 440), cv::FONT_HERSHEY_SIMPLEX, 1.0, cv::Scalar(0, 128, 255), 2);
-				}
-
+			if (cam == 0 && kVisualization && renderer == nullptr) {
+				cv::Mat img_rgb_debug;
+				// The model status is drawn from the model itself, which the pipeline updates on another thread
+				trackers[cam]->render(tracked, img_rgb_debug, kPipelinedTracking == false);
 				cv::imshow(window_names[cam], img_rgb_debug);
-
 			} // Visualization
 
 		} // For each cameras
+		if (renderer && is_frame_available) {
+			renderer->submit(tracked_frames);
+		}
 
 		// Compute FPS
 		frame_rate_counter.count();
+		if (loop_statistics.update() && (kLatestFrameMode || is_thread_policy_set)) {
+			for (size_t cam = 0; cam < kCameraNums; cam++) {
+				std::cout << "Cam" << cam << ": " << loop_statistics.last()[cam] << std::endl;
+			}
+		}
 		// Print current frame data
 		static int ss = 0;
 		if (ss++ > 100) {
 			std::cout << "Frame #" << frame_rate_counter.frame_count() << ", FPS=" << frame_rate_counter.fps() << std::endl;
+			for (size_t cam = 0; cam < kCameraNums; cam++) {
+				std::cout << "  Cam" << cam << ": sequence=" << tracked_frames[cam].sample.frame.sequence
+					<< ", capture-to-result latency=" << tracked_frames[cam].sample.latency_ms() << " ms" << std::endl;
+			}
+			for (size_t cam = 0; cam < kCameraNums; cam++) {
+				if (synthetic_cameras[cam] != nullptr) {
+					std::cout << "  Cam" << cam << ": " << tracking_errors[cam] << std::endl;
+					tracking_errors[cam].reset();
+				}
+			}
+			if (kTemporalTracking) {
+				for (size_t cam = 0; cam < kCameraNums; cam++) {
+					const TemporalTrackingStatistics &search = search_statistics[cam];
+					std::cout << "  Cam" << cam << ": pupils found=" << search.found << "/" << search.frames << ", tracked in window="
+						<< search.tracked << ", fallbacks to full frame=" << search.fallbacks << ", hit rate=" << search.hitRate() << std::endl;
+					search_statistics[cam].reset();
+				}
+			}
+			if (kPipelinedTracking) {
+				eye_tracker::print_pipeline_statistics(pipeline);
+			}
+			if (renderer) {
+				eye_tracker::RenderStatistics render_stats = renderer->statistics();
+				std::cout << "  Display: submitted=" << render_stats.submitted << ", rendered=" << render_stats.rendered
+					<< ", dropped=" << render_stats.dropped << std::endl;
+			}
+			{
+				eye_tracker::SchedulerStatistics scheduler_stats = eye_tracker::TaskScheduler::shared().statistics();
+				std::cout << "  Scheduler: workers=" << scheduler_stats.workers << ", executed=" << scheduler_stats.executed
+					<< ", stolen=" << scheduler_stats.stolen << ", pinned=" << scheduler_stats.pinned
+					<< ", realtime=" << scheduler_stats.realtime << std::endl;
+			}
+			if (kPooledFrameBuffers) {
+				eye_tracker::FramePoolStatistics pool_stats = frame_pool.statistics();
+				std::cout << "  Frame pool: hits=" << pool_stats.hits << ", misses=" << pool_stats.misses
+					<< ", bypassed=" << pool_stats.bypassed << ", in use=" << pool_stats.in_use << std::endl;
+			}
+			if (kThreadedCapture) {
+				for (size_t cam = 0; cam < kCameraNums; cam++) {
+					eye_tracker::CaptureStatistics stats = static_cast<eye_tracker::EyeCameraThreaded*>(eyecams[cam].get())->statistics();
+					std::cout << "  Cam" << cam << ": captured=" << stats.captured << ", processed=" << stats.delivered
+						<< ", dropped=" << stats.dropped << ", overwritten=" << stats.overwritten << std::endl;
+				}
+			}
 			ss = 0;
 		}
 
 	}// Main capture loop
 
+	renderer.reset();
+	pipeline.stop();
 	return 0;
 
 }
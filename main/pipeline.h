@@ -0,0 +1,226 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <iostream>
+#include "bounded_queue.h"
+#include "frame.h"
+#include "thread_policy.h"
+
+namespace eye_tracker
+{
+
+/// Counters of one pipeline stage and of the queue feeding it
+struct StageStatistics {
+	std::string name;
+	size_t processed = 0; ///< Items the stage has finished
+	double busy_ms = 0;   ///< Total time spent working on items
+	QueueStatistics input; ///< Queue in front of the stage; empty for the source
+};
+
+/**
+* @class Pipeline
+* @brief Runs a chain of stages on their own threads, connected by bounded queues.
+*
+* A source function produces the items, each stage works on them in place and
+* hands them on, and the consumer takes the finished items with pop(), so the
+* output stage runs on the calling thread (e.g. the HighGUI thread). Every
+* stage has exactly one thread and every queue is FIFO, so items come out in
+* the order the source produced them. While the queues have room, the stages
+* work on different items at the same time: throughput is set by the slowest
+* stage instead of the sum of all of them. When the consumer or a stage falls
+* behind, the queues fill up and the upstream stages block, down to the source.
+*/
+template<typename T>
+class Pipeline
+{
+public:
+	/// @param queue_depth number of items that may wait in front of each stage
+	explicit Pipeline(size_t queue_depth = 2)
+		: queue_depth_(queue_depth), is_stopping_(false)
+	{
+	}
+	~Pipeline() {
+		stop();
+	}
+
+	/// Sets the first stage. It is called repeatedly and returns false at the end of the stream
+	void setSource(const std::string &name, std::function<bool(T&)> source) {
+		source_ = source;
+		source_stats_.name = name;
+	}
+	/// Appends a stage. Stages run in the order they were added
+	void addStage(const std::string &name, std::function<void(T&)> work) {
+		std::unique_ptr<Stage> stage(new Stage(queue_depth_));
+		stage->work = work;
+		stage->stats.name = name;
+		stages_.push_back(std::move(stage));
+	}
+	/// Names the consumer calling pop() in the statistics
+	void setOutputName(const std::string &name) { output_stats_.name = name; }
+	/// Core and priority of the source thread and of the stage threads (stage i takes core i of its policy),
+	/// applied by start()
+	void setThreadPolicy(const ThreadPolicy &source_policy, const ThreadPolicy &stage_policy) {
+		source_policy_ = source_policy;
+		stage_policy_ = stage_policy;
+	}
+	/// What the thread policies achieved for the threads that have one, after start()
+	const std::vector<ThreadPolicyResult>& threadPolicies() const { return thread_policies_; }
+
+	/// Starts the source and stage threads. A pipeline runs once
+	void start() {
+		if (output_ != nullptr) return;
+		if (source_ == nullptr) {
+			throw "Pipeline: no source";
+		}
+		output_ = std::make_unique<BoundedQueue<T>>(queue_depth_);
+		is_stopping_ = false;
+		threads_.emplace_back(&Pipeline::source_loop, this);
+		if (source_policy_.is_set()) {
+			thread_policies_.push_back(apply_thread_policy(threads_.back(), source_stats_.name, source_policy_));
+		}
+		for (size_t i = 0; i < stages_.size(); i++) {
+			threads_.emplace_back(&Pipeline::stage_loop, this, i);
+			if (stage_policy_.is_set()) {
+				thread_policies_.push_back(apply_thread_policy(threads_.back(), stages_[i]->stats.name, stage_policy_, i));
+			}
+		}
+	}
+
+	/// Takes the next finished item. Returns false once the source ended and all items were delivered
+	bool pop(T &item) {
+		if (output_ == nullptr) return false;
+		const Clock::time_point now = Clock::now();
+		if (is_output_busy_) {
+			// Time since the last item was handed out is spent in the output stage
+			std::lock_guard<std::mutex> lock(stats_mutex_);
+			output_stats_.busy_ms += std::chrono::duration<double, std::milli>(now - last_pop_time_).count();
+		}
+		is_output_busy_ = output_->pop(item);
+		last_pop_time_ = Clock::now();
+		if (is_output_busy_) {
+			std::lock_guard<std::mutex> lock(stats_mutex_);
+			output_stats_.processed++;
+		}
+		return is_output_busy_;
+	}
+
+	/// Stops the source, discards the items in flight and joins all threads
+	void stop() {
+		is_stopping_ = true;
+		for (auto &stage : stages_) {
+			stage->input.close();
+		}
+		if (output_ != nullptr) {
+			output_->close();
+		}
+		for (auto &t : threads_) {
+			if (t.joinable()) t.join();
+		}
+		threads_.clear();
+	}
+
+	/// Counters of the source, every stage and the output, in pipeline order
+	std::vector<StageStatistics> statistics() const {
+		std::vector<StageStatistics> stats;
+		std::lock_guard<std::mutex> lock(stats_mutex_);
+		stats.push_back(source_stats_);
+		for (auto &stage : stages_) {
+			stats.push_back(stage->stats);
+			stats.back().input = stage->input.statistics();
+		}
+		stats.push_back(output_stats_);
+		if (output_ != nullptr) {
+			stats.back().input = output_->statistics();
+		}
+		return stats;
+	}
+
+protected:
+	struct Stage {
+		explicit Stage(size_t depth) : input(depth) {}
+		std::function<void(T&)> work;
+		BoundedQueue<T> input;
+		StageStatistics stats; // Guarded by stats_mutex_
+	};
+
+	/// Queue behind stage i, i.e. the input of stage i + 1 or the output queue
+	BoundedQueue<T>& next_queue(size_t i) {
+		return (i + 1 < stages_.size()) ? stages_[i + 1]->input : *output_;
+	}
+
+	void source_loop() {
+		BoundedQueue<T> &out = stages_.empty() ? *output_ : stages_[0]->input;
+		while (is_stopping_ == false) {
+			T item;
+			const Clock::time_point t0 = Clock::now();
+			if (source_(item) == false) break;
+			add_busy_time(source_stats_, t0);
+			if (out.push(std::move(item)) == false) break;
+		}
+		out.close(); // Downstream stages finish the items in flight, then end
+	}
+
+	void stage_loop(size_t i) {
+		Stage &stage = *stages_[i];
+		BoundedQueue<T> &out = next_queue(i);
+		T item;
+		while (stage.input.pop(item)) {
+			const Clock::time_point t0 = Clock::now();
+			stage.work(item);
+			add_busy_time(stage.stats, t0);
+			if (out.push(std::move(item)) == false) break;
+		}
+		out.close();
+	}
+
+	void add_busy_time(StageStatistics &stats, const Clock::time_point &t0) {
+		const double ms = millisecondsSince(t0);
+		std::lock_guard<std::mutex> lock(stats_mutex_);
+		stats.processed++;
+		stats.busy_ms += ms;
+	}
+
+	const size_t queue_depth_;
+	std::function<bool(T&)> source_;
+	std::vector<std::unique_ptr<Stage>> stages_;
+	std::unique_ptr<BoundedQueue<T>> output_;
+	std::atomic<bool> is_stopping_;
+	std::vector<std::thread> threads_;
+	ThreadPolicy source_policy_;
+	ThreadPolicy stage_policy_;
+	std::vector<ThreadPolicyResult> thread_policies_;
+
+	mutable std::mutex stats_mutex_;
+	StageStatistics source_stats_;
+	StageStatistics output_stats_;
+	bool is_output_busy_ = false; // The consumer holds an item from pop()
+	Clock::time_point last_pop_time_;
+private:
+	// Prevent copying
+	Pipeline(const Pipeline& other);
+	Pipeline& operator=(const Pipeline& rhs);
+};
+
+/// Prints one line per stage: items, mean time per item, and fill level of its input queue
+template<typename T>
+void print_pipeline_statistics(const Pipeline<T> &pipeline) {
+	for (const StageStatistics &stage : pipeline.statistics()) {
+		std::cout << "  " << stage.name << ": items=" << stage.processed
+			<< ", " << (stage.processed > 0 ? stage.busy_ms / stage.processed : 0) << " ms/item";
+		if (stage.input.capacity > 0) {
+			std::cout << ", queue=" << stage.input.size << "/" << stage.input.capacity << " (peak " << stage.input.peak
+				<< "), waited full=" << stage.input.full_waits << ", empty=" << stage.input.empty_waits;
+		}
+		std::cout << std::endl;
+	}
+}
+
+} // namespace
+#endif // PIPELINE_H
@@ -1,9 +1,15 @@
+#ifndef PUPIL_FITTER_H
+#define PUPIL_FITTER_H
+
 #include <opencv2/core/core.hpp>
-#include <opencv2/opencv.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+// The EyeTracker library is built without HighGUI; the debug windows are then not shown
+#ifndef EYE_TRACKER_NO_HIGHGUI
+#include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/features2d/features2d.hpp>
 #include <opencv2/video/background_segm.hpp>
+#endif
 
 #include <iostream>
 #include <fstream>
@@ -11,16 +17,187 @@
 //#include <dirent.h>
 #include <string>
 #include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
 #include <sys/stat.h>
 #include <time.h>
 #include <sys/timeb.h>
 #include <ctime>
 
 #include "fit_ellipse.h"
+#include "frame.h"
 
 using namespace std;
 using namespace cv;
 
+/**
+How the pupil of a frame was searched, see PupilFitter::setTemporalTracking
+*/
+enum class PupilSearch {
+	FULL_FRAME, // Whole frame, no pupil in the previous frame or tracking is off
+	TRACKED,    // Only the window predicted from the previous frames, and found there
+	FALLBACK    // Not found in the predicted window, then the whole frame
+};
+
+/**
+2D pupil detection result, tagged with the capture record of the frame it was found in
+*/
+struct PupilDetection {
+	eye_tracker::FrameInfo frame;
+	bool is_found = false;
+	RotatedRect rect;
+	vector<Point2f> inliers;
+	PupilSearch search = PupilSearch::FULL_FRAME;
+};
+
+/**
+Counts how the detections of a stream were searched: the hit rate of temporal tracking
+*/
+struct TemporalTrackingStatistics {
+	size_t frames = 0;
+	size_t found = 0;
+	size_t tracked = 0;   // Found in the predicted window
+	size_t fallbacks = 0; // Lost in the predicted window and searched in the whole frame
+
+	void add(const PupilDetection &detection) {
+		frames++;
+		if (detection.is_found) found++;
+		if (detection.search == PupilSearch::TRACKED) tracked++;
+		if (detection.search == PupilSearch::FALLBACK) fallbacks++;
+	}
+	/// Share of the window searches that found the pupil
+	double hitRate() const {
+		return (tracked + fallbacks) > 0 ? static_cast<double>(tracked) / (tracked + fallbacks) : 0;
+	}
+	void reset() { *this = TemporalTrackingStatistics(); }
+};
+
+/**
+256-bin histogram of 8 bit intensities. Order statistics (minimum, percentiles) of an image
+region in one O(n) pass, without sorting and without allocating
+*/
+struct IntensityHistogram {
+	int bins[256];
+	int count = 0;
+
+	IntensityHistogram() { clear(); }
+
+	void clear() {
+		std::fill(bins, bins + 256, 0);
+		count = 0;
+	}
+
+	/**
+	Counts the pixels of every step-th column of every step-th row, leaving out border pixels on all sides
+	@param I 8 bit single channel image
+	*/
+	void add(const Mat &I, int step = 1, int border = 0) {
+		CV_Assert(I.depth() == CV_8U && I.channels() == 1 && step > 0);
+		// Four banks, so that runs of equal pixels do not wait on their own previous increment
+		int banks[4][256] = {};
+		const int colEnd = I.cols - border;
+		for (int i = border; i < I.rows - border; i += step) {
+			const uchar* p = I.ptr<uchar>(i);
+			int j = border;
+			for (; j + 3 * step < colEnd; j += 4 * step) {
+				banks[0][p[j]]++;
+				banks[1][p[j + step]]++;
+				banks[2][p[j + 2 * step]]++;
+				banks[3][p[j + 3 * step]]++;
+			}
+			for (; j < colEnd; j += step) {
+				banks[0][p[j]]++;
+			}
+		}
+		for (int v = 0; v < 256; v++) {
+			const int n = banks[0][v] + banks[1][v] + banks[2][v] + banks[3][v];
+			bins[v] += n;
+			count += n;
+		}
+	}
+
+	/// k-th smallest counted intensity (0 based), i.e. element k of the sorted samples; 255 if there are not that many
+	int nth(int k) const {
+		int cumulative = 0;
+		for (int v = 0; v < 256; v++) {
+			cumulative += bins[v];
+			if (cumulative > k) {
+				return v;
+			}
+		}
+		return 255;
+	}
+
+	/// Intensity below which the given fraction (0..1) of the counted pixels lie
+	int percentile(double fraction) const {
+		return nth(static_cast<int>(count * fraction));
+	}
+};
+
+/**
+Spatial constants of the detector for one frame size. The detector was tuned on 640x480 frames (the
+reference size): lengths scale with the square root of the frame area over the reference area, positions
+in the frame with its width and height. At the reference size all values are the tuned ones
+*/
+struct PupilGeometry {
+	Size frame;
+	double scale = 1;      // Length scale relative to the reference frame
+	int size = 240;        // Side of the pupil ROI
+	int darkSquare = 30;   // Half width of the darkness square of the coarse localisation
+	int coarseScale = 4;   // Block size of the coarse localisation
+	Point searchMin;       // Pupil centres are searched right of and below this point (pupilSearchXMin/YMin)
+	int searchTop = 60;    // ... below this row
+	int searchRight = 530; // ... and left of this column
+	int minPupil = 10;     // Smallest pupil width/height
+	int minWindow = 64;    // Smallest temporal tracking window
+
+	/// Whether the frame holds the pupil ROI; frames smaller than 52x52 do not
+	bool isSearchable() const { return size < std::min(frame.width, frame.height); }
+};
+
+/**
+Scratch state of one PupilFitter detection: intermediate images and point lists,
+reused from call to call so that the detection does not reallocate them, and the
+previous ellipse of the stream for badEllipseFilter. Every thread detecting with
+a shared PupilFitter needs its own workspace.
+*/
+struct PupilFitterWorkspace {
+	Mat gray;       // Single channel copy of a BGR input
+	Mat eroded;     // Eroded input when erodeOn is set
+	Mat threshLow;  // Dark threshold of the pupil ROI
+	Mat threshHigh; // Lighter threshold of the pupil ROI
+	Mat thresh3;    // Canny edges of threshLow, later the drawn ellipse masks
+	Mat thresh4;    // Canny edges of threshHigh
+	Mat debug;      // Canvas of the candidate point drawing in getCandidates
+	vector<ushort> coarseRow; // Column sums of one row of coarse blocks (dense coarse localisation)
+	Mat coarseIntegral;       // Integral image of the coarse block sums around the search area
+	Mat fineInput;            // Pupil window scaled down to the reference resolution (coarse-to-fine mode)
+	vector<Point2f> finePts;  // Edge points found in fineInput
+	std::vector<std::vector<cv::Point>> contoursLow;
+	std::vector<std::vector<cv::Point>> contoursHigh;
+	std::vector<std::vector<cv::Point>> ellipseContour;
+	vector<Point> allPts;
+	vector<Point> allPts2;
+	vector<Point> allPtsHigh;
+	std::vector<std::vector<cv::Point>> allPtsWithOutliers;
+
+	//rect for comparing previous frame, used in bad ellipse filtering process and temporal tracking
+	RotatedRect previousRect = RotatedRect(Point2f(0, 0), Size2f(0, 0), 0);
+	//temporal tracking state: previousRect is the pupil of the previous frame, moving by velocity per frame
+	bool isTracking = false;
+	Point2f velocity = Point2f(0, 0);
+	PupilSearch lastSearch = PupilSearch::FULL_FRAME; // How the last detection was searched
+};
+
+/**
+2D pupil detector.
+
+The detection itself is const: it reads the configured parameters and keeps all
+per-call state in a PupilFitterWorkspace, so one configured detector can be used
+by many threads at once, each with its own workspace. The overloads without a
+workspace argument use the detector's own workspace and are not thread-safe.
+*/
 class PupilFitter{
 public:
 	PupilFitter(){
@@ -34,11 +211,133 @@ public:
 		threshDebug = threshDebug0;
 	};
 
+	/// Shows an intermediate image in a window when debugging is on
+	void showDebug(const char *window_name, const Mat &img) const{
+#ifndef EYE_TRACKER_NO_HIGHGUI
+		if (threshDebug) {
+			imshow(window_name, img);
+		}
+#endif
+	}
+
 /**
-Fits an ellipse to a pupil area in an image
-@param gray BGR input image (converted to grayscale during search process)
+Sets the detection parameters (magic numbers); these should be set per-user.
+Lengths and positions are in pixels of the reference frame size, see setReferenceFrameSize
+*/
+void setParameters(int pupilSearchAreaIn = 10, int pupilSearchXMinIn = 0, int pupilSearchYMinIn = 0,
+	int lowThresholdCannyIn = 10, int highThresholdCannyIn = 30,
+	int sizeIn = 240, int darkestPixelL1In = 10, int darkestPixelL2In = 20)
+{
+	lowThresholdCanny = lowThresholdCannyIn; //default 10: for detecting dark (low contrast) parts of pupil
+	highThresholdCanny = highThresholdCannyIn; //default 30: for detecting lighter (high contrast) parts of pupil
+	size = sizeIn; //default 280: max L/H of pupil
+	darkestPixelL1 = darkestPixelL1In; //default 10: for setting low darkness threshold
+	darkestPixelL2 = darkestPixelL2In; //default 20: for setting high darkness threshold
+	pupilSearchArea = pupilSearchAreaIn; //default 20: for setting min size of pupil in pixels / 2 
+	pupilSearchXMin = pupilSearchXMinIn; //default 0: distance from left side of image to start pupil search  
+	pupilSearchYMin = pupilSearchYMinIn; //default 0: distance from right side of image to start pupil search  
+	erodeOn = false; //perform erode operation: turn off for one-offs, where eroding the image may actually hurt accuracy
+}
+
+/**
+Sets the frame size the parameters (setParameters, the ROI size and the search area) are given for.
+The detector scales them to the size of each frame, see PupilGeometry
+*/
+void setReferenceFrameSize(const Size &reference = Size(640, 480))
+{
+	referenceSize = reference;
+}
+
+/**
+Sets the coarse-to-fine mode for frames larger than the reference size: the pupil window is scaled down
+to the reference resolution for the detection, and only the edge points found there are refined and the
+ellipse refitted at full resolution. The cost then stays about that of a reference frame.
+@param minScale used from this length scale (see PupilGeometry::scale) up
+*/
+void setCoarseToFine(bool isOn, double minScale = 1.25)
+{
+	coarseToFine = isOn;
+	coarseToFineMinScale = minScale;
+}
+
+/// Spatial constants of the detector for frames of the given size
+PupilGeometry geometry(const Size &frame) const
+{
+	PupilGeometry g;
+	g.frame = frame;
+	g.scale = std::sqrt(static_cast<double>(frame.area()) / referenceSize.area());
+	const double sx = static_cast<double>(frame.width) / referenceSize.width;
+	const double sy = static_cast<double>(frame.height) / referenceSize.height;
+	//the ROI stays a pixel inside the frame (see correctBounds) and larger than the 50x50 getDarkestPixelBetter needs
+	g.size = std::max(51, std::min(cvRound(size * g.scale), std::min(frame.width, frame.height) - 1));
+	g.darkSquare = std::max(1, cvRound(30 * g.scale));
+	g.coarseScale = std::max(1, cvRound(coarseScale * g.scale));
+	g.searchMin = Point(cvRound(pupilSearchXMin * sx), cvRound(pupilSearchYMin * sy));
+	g.searchTop = cvRound(60 * sy);
+	g.searchRight = cvRound(530 * sx);
+	g.minPupil = std::max(3, cvRound(10 * g.scale));
+	g.minWindow = std::max(56, cvRound(64 * g.scale));
+	return g;
+}
+
+/**
+Sets the coarse pupil localisation. By default the dark square is found by the sampled grid search, whose
+early exits make it the cheaper one on typical frames; the dense search scores every block position with
+an integral image, which finds the pupil more accurately at a fixed but higher cost
+@param isDense use the dense search
+@param scale side of the pixel blocks whose centres the dense search scores, at the reference frame size
+*/
+void setCoarseLocalisation(bool isDense, int scale = 4)
+{
+	denseLocalisation = isDense;
+	coarseScale = std::max(1, scale);
+}
+
+/**
+Sets the sampling of the pupil ROI for the darkness threshold
+@param step every step-th pixel of every step-th row is counted; 1 counts every pixel
+*/
+void setDarknessSampling(int step = 5)
+{
+	darknessSampleStep = std::max(1, step);
+}
+
+/**
+Sets temporal tracking. When on, a detection first searches only a window around the pupil of the
+previous frame, moved on by its last motion, and accepts the result if it is a plausible pupil inside
+the window and of about the previous size; otherwise (blink, saccade, first frame) it searches the
+whole frame as before. The tracking state lives in the workspace, so a workspace should see the
+frames of one stream in order.
+@param windowScale window side relative to the previous pupil size
+*/
+void setTemporalTracking(bool isOn, float windowScale = 2.0f)
+{
+	temporalTracking = isOn;
+	trackingWindowScale = std::max(1.0f, windowScale);
+}
+
+/**
+Runs only the dense coarse localisation (see setCoarseLocalisation). Thread-safe for distinct workspaces
+@return the centre of the darkest square
+*/
+Point locateDarkArea(const Mat &gray, PupilFitterWorkspace &ws) const
+{
+	return getDarkestPixelArea(gray, geometry(gray.size()), ws);
+}
+
+/**
+Runs only the sampled coarse localisation, a search on a 10 pixel grid (at 640x480)
+*/
+Point locateDarkAreaSampled(const Mat &gray) const
+{
+	return getDarkestPixelAreaSampled(gray, geometry(gray.size()));
+}
+
+/**
+Fits an ellipse to a pupil area in an image, with the given parameters. Not thread-safe
+@param gray 8 bit single channel input image (a BGR image is converted to grayscale in place once)
 @param rr resulting RotatedRect representing the popil ellipse contour 
-@param allPtsReturn Point2f vector containing all 
+@param allPtsReturn Point2f vector containing all edge points the ellipse was fitted to, in image coordinates
 @return a RotatedRect representing the pupil ellipse, returns RotatedRect with all 0s if ellipse was not found
 */
 bool pupilAreaFitRR(Mat &gray, RotatedRect &rr, vector<Point2f> &allPtsReturn,
@@ -46,32 +345,117 @@ bool pupilAreaFitRR(Mat &gray, RotatedRect &rr, vector<Point2f> &allPtsReturn,
 	int lowThresholdCannyIn = 10, int highThresholdCannyIn = 30,
 	int sizeIn = 240, int darkestPixelL1In = 10, int darkestPixelL2In = 20) 
 	{
+		setParameters(pupilSearchAreaIn, pupilSearchXMinIn, pupilSearchYMinIn, lowThresholdCannyIn, highThresholdCannyIn,
+			sizeIn, darkestPixelL1In, darkestPixelL2In);
 
-		//global params (magic numbers) for setting, these should be set per-user, see main for params
-		//default values
-		lowThresholdCanny = lowThresholdCannyIn; //default 10: for detecting dark (low contrast) parts of pupil
-		highThresholdCanny = highThresholdCannyIn; //default 30: for detecting lighter (high contrast) parts of pupil
-		size = sizeIn; //default 280: max L/H of pupil
-		darkestPixelL1 = darkestPixelL1In; //default 10: for setting low darkness threshold
-		darkestPixelL2 = darkestPixelL2In; //default 20: for setting high darkness threshold
-		pupilSearchArea = pupilSearchAreaIn; //default 20: for setting min size of pupil in pixels / 2 
-		pupilSearchXMin = pupilSearchXMinIn; //default 0: distance from left side of image to start pupil search  
-		pupilSearchYMin = pupilSearchYMinIn; //default 0: distance from right side of image to start pupil search  
-		erodeOn = false; //perform erode operation: turn off for one-offs, where eroding the image may actually hurt accuracy
+		//the whole search works on a single channel image, convert only once if a BGR image was passed
+		if (gray.channels() == 3) {
+			cv::cvtColor(gray, gray, CV_BGR2GRAY);
+		}
+		return pupilAreaFitRR(static_cast<const Mat&>(gray), workspace, rr, allPtsReturn);
+	}
 
+/**
+Fits an ellipse to a pupil area in an image. Thread-safe for distinct workspaces
+@param input 8 bit single or three channel input image; it is not modified
+@param ws scratch state of the calling thread
+@param rr resulting RotatedRect representing the popil ellipse contour 
+@param allPtsReturn Point2f vector containing all edge points the ellipse was fitted to, in image coordinates
+@return true if a pupil was found
+*/
+bool pupilAreaFitRR(const Mat &input, PupilFitterWorkspace &ws, RotatedRect &rr, vector<Point2f> &allPtsReturn) const
+	{
 		//for timing funcitons
 		unsigned long long Int64 = 0;
 		clock_t Start = clock();
 
+		//the whole search works on a single channel image, convert only once if a BGR image was passed
+		Mat gray = input;
+		if (input.channels() == 3) {
+			cv::cvtColor(input, ws.gray, CV_BGR2GRAY);
+			gray = ws.gray;
+		}
+
+		//spatial constants for this frame size
+		const PupilGeometry g = geometry(gray.size());
+		ws.lastSearch = PupilSearch::FULL_FRAME;
+		if (g.isSearchable() == false) {
+			updateTracking(ws, false, rr);
+			return false;
+		}
+
+		//temporal tracking: search the window around the pupil predicted from the previous frames first
+		const size_t pointCount = allPtsReturn.size();
+		if (temporalTracking && ws.isTracking) {
+			const Rect window = trackingWindow(g, ws);
+			if (window.width > 50 && window.height > 50 &&
+				fitPupil(gray, window, g, ws, rr, allPtsReturn) && isTrackedPupil(rr, window, ws.previousRect, g)) {
+				ws.lastSearch = PupilSearch::TRACKED;
+				updateTracking(ws, true, rr);
+				return true;
+			}
+			//lost (blink, fast saccade): forget the window's result and search the whole frame
+			allPtsReturn.resize(pointCount);
+			ws.lastSearch = PupilSearch::FALLBACK;
+		}
+
 		//find pupil
-		Point darkestPixelConfirm = getDarkestPixelArea(gray);
+		Point darkestPixelConfirm = denseLocalisation ? getDarkestPixelArea(gray, g, ws) : getDarkestPixelAreaSampled(gray, g);
 
 
 		//correct bounds
-		darkestPixelConfirm = correctBounds(darkestPixelConfirm, size);
+		darkestPixelConfirm = correctBounds(darkestPixelConfirm, g.size, gray.size());
+
+		const bool isFound = fitPupil(gray, Rect(darkestPixelConfirm.x, darkestPixelConfirm.y, g.size, g.size), g, ws, rr, allPtsReturn);
+		if (temporalTracking) {
+			updateTracking(ws, isFound, rr);
+		}
+		return isFound;
+	}
+
+/**
+Fits an ellipse to the pupil of a captured frame. Not thread-safe
+@param frame grayscale frame; its capture record is copied to the detection
+@param detection resulting ellipse and inlier points
+@return true if a pupil was found
+*/
+bool pupilAreaFitRR(eye_tracker::Frame &frame, PupilDetection &detection)
+{
+	return pupilAreaFitRR(static_cast<const eye_tracker::Frame&>(frame), workspace, detection);
+}
+
+/**
+Fits an ellipse to the pupil of a captured frame. Thread-safe for distinct workspaces
+@param frame 8 bit frame, not modified; its capture record is copied to the detection
+@param ws scratch state of the calling thread
+@param detection resulting ellipse and inlier points
+@return true if a pupil was found
+*/
+bool pupilAreaFitRR(const eye_tracker::Frame &frame, PupilFitterWorkspace &ws, PupilDetection &detection) const
+{
+	detection.frame = frame.info;
+	detection.inliers.clear();
+	detection.is_found = pupilAreaFitRR(frame.image, ws, detection.rect, detection.inliers);
+	detection.search = ws.lastSearch;
+	return detection.is_found;
+}
+
+private:
+/**
+Fits an ellipse to the pupil inside a window of the image: thresholds at the darkness of the window,
+takes the biggest dark contours and refines their edge points with the Canny edges and ellipse fits
+@param input 8 bit single channel image
+@param window area searched, inside the image and larger than 50x50
+@param g spatial constants for the size of input
+@return true if a pupil was found; rr and the appended points are in image coordinates
+*/
+bool fitPupilInWindow(const Mat &input, const Rect &window, const PupilGeometry &g, PupilFitterWorkspace &ws, RotatedRect &rr, vector<Point2f> &allPtsReturn) const
+	{
+		Mat gray = input;
+		Point darkestPixelConfirm = window.tl();
 
 		//find darkest pixel (for thresholding
-		int darkestPixel = getDarkestPixelBetter(gray(cv::Rect(darkestPixelConfirm.x, darkestPixelConfirm.y, size, size)));
+		int darkestPixel = getDarkestPixelBetter(gray(window));
 
 		int kernel_size = 3;
 		int scale = 1;
@@ -80,30 +464,29 @@ bool pupilAreaFitRR(Mat &gray, RotatedRect &rr, vector<Point2f> &allPtsReturn,
 
 		int erosion_size = 3;
 		int erosion_type = MORPH_ELLIPSE;
-		Mat element = getStructuringElement(erosion_type,
-			Size(2 * erosion_size + 1, 2 * erosion_size + 1),
-			Point(erosion_size, erosion_size));
 
 		/// Apply the erosion operation
 		if (erodeOn) {
-			erode(gray, gray, element);
+			Mat element = getStructuringElement(erosion_type,
+				Size(2 * erosion_size + 1, 2 * erosion_size + 1),
+				Point(erosion_size, erosion_size));
+			erode(gray, ws.eroded, element);
+			gray = ws.eroded;
 		}
 
 		//set ROI and thresh for testing
-		threshold(gray(cv::Rect(darkestPixelConfirm.x, darkestPixelConfirm.y, size, size)), threshLow, (darkestPixel + darkestPixelL1), 255, 1);
+		threshold(gray(window), ws.threshLow, (darkestPixel + darkestPixelL1), 255, 1);
 
-		if (threshDebug) {
-			//test threshing
-			imshow("threshLow", threshLow);
-			//waitKey(1);
-		}
+		//test threshing
+		showDebug("threshLow", ws.threshLow);
 		 
 		//Find contours
-		std::vector<std::vector<cv::Point>> contoursLow;
-		cv::findContours(threshLow, contoursLow, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
+		std::vector<std::vector<cv::Point>> &contoursLow = ws.contoursLow;
+		contoursLow.clear();
+		cv::findContours(ws.threshLow, contoursLow, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
 
 		//get biggest contours (pupils)
-		int biggest = getBiggest(contoursLow).at(0);
+		int biggest = getBiggest(contoursLow, g).at(0);
 
 		//get bounding rect center 
 		Rect minPts = boundingRect(contoursLow.at(biggest));
@@ -120,25 +503,20 @@ bool pupilAreaFitRR(Mat &gray, RotatedRect &rr, vector<Point2f> &allPtsReturn,
 		}
 
 		//max size of pupil ROI
-		int size2 = size;
+		const Mat grayRoi = gray(window);
 
 		//Thresh 2
-		threshold(gray(cv::Rect(darkestPixelConfirm.x, darkestPixelConfirm.y, size2, size2)), threshHigh, (darkestPixel + darkestPixelL2), 255, 1);
+		threshold(grayRoi, ws.threshHigh, (darkestPixel + darkestPixelL2), 255, 1);
 
-		if (threshDebug) {
-			//test threshing
-			imshow("threshMid", threshHigh);
-			//waitKey(1);
-		}
+		//test threshing
+		showDebug("threshMid", ws.threshHigh);
 
 		//contours for high thresh
-		std::vector<std::vector<cv::Point>> contoursHigh;
-		cv::findContours(threshHigh, contoursHigh, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
-
-		int biggestHigh = getBiggest(contoursHigh).at(0);
+		std::vector<std::vector<cv::Point>> &contoursHigh = ws.contoursHigh;
+		contoursHigh.clear();
+		cv::findContours(ws.threshHigh, contoursHigh, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
 
-		//convert back to 3 channel for drawing
-		cv::cvtColor(gray, gray, CV_GRAY2BGR);
+		int biggestHigh = getBiggest(contoursHigh, g).at(0);
 
 		Scalar colorC = Scalar(0, 255, 0);
 		Scalar colorE = Scalar(0, 0, 255);
@@ -150,38 +528,31 @@ bool pupilAreaFitRR(Mat &gray, RotatedRect &rr, vector<Point2f> &allPtsReturn,
 		int kernel2 = 3;
 
 		//run Canny to get best candiate points from contours 
-		Canny(gray(cv::Rect(darkestPixelConfirm.x, darkestPixelConfirm.y, size2, size2)), thresh3, lowThresholdCanny, lowThresholdCanny*ratio, kernel2);
-		Canny(gray(cv::Rect(darkestPixelConfirm.x, darkestPixelConfirm.y, size2, size2)), thresh4, highThresholdCanny, highThresholdCanny*ratio, kernel2);
+		Canny(grayRoi, ws.thresh3, lowThresholdCanny, lowThresholdCanny*ratio, kernel2);
+		Canny(grayRoi, ws.thresh4, highThresholdCanny, highThresholdCanny*ratio, kernel2);
 
-		if (threshDebug) {
-			imshow("cannyLow", thresh3);
-			//waitKey(1);
-			imshow("cannyHigh", thresh4);
-			//waitKey(1);
-		}
+		showDebug("cannyLow", ws.thresh3);
+		showDebug("cannyHigh", ws.thresh4);
 
 		//holds sets of candidate points for different points throughout refinement
-	//	vector<Point> allPts;
-		allPts.resize(0);
-		vector<Point> allPts2;
-		vector<Point> allPtsHigh;
+		vector<Point> &allPts = ws.allPts;
+		vector<Point> &allPts2 = ws.allPts2;
+		vector<Point> &allPtsHigh = ws.allPtsHigh;
+		allPts2.clear();
 
 		//logical AND of contours and canny images
-		allPts = getCandidates(contoursLow, biggest, thresh3, false);
-		allPtsHigh = getCandidates(contoursHigh, biggestHigh, thresh4, false);
+		allPts = getCandidates(contoursLow, biggest, ws.thresh3, ws.debug, false);
+		allPtsHigh = getCandidates(contoursHigh, biggestHigh, ws.thresh4, ws.debug, false);
 
 		//merge remaining points for low and high point lists 
 		allPts.insert(allPts.end(), allPtsHigh.begin(), allPtsHigh.end());
-		std::vector<std::vector<cv::Point>> allPtsWithOutliers;
-		allPtsWithOutliers.push_back(allPts);
-
-		//convert to gray for refinement
-		cv::cvtColor(gray, gray, CV_BGR2GRAY);
+		std::vector<std::vector<cv::Point>> &allPtsWithOutliers = ws.allPtsWithOutliers;
+		allPtsWithOutliers.resize(1);
+		allPtsWithOutliers[0] = allPts;
 
 		//refine points based on line fitting - Thanks Yuta! 
 		if (allPts.size() > 5) {
-			allPts = refinePoints(allPts, gray(cv::Rect(darkestPixelConfirm.x, darkestPixelConfirm.y, size2, size2)), 
-				8, 2, gray(cv::Rect(darkestPixelConfirm.x, darkestPixelConfirm.y, size2, size2)), true);
+			allPts = refinePoints(allPts, grayRoi, 8, 2, grayRoi, true);
 			//temp = gray.clone();
 			////add contours that also exist in canny, and if candidatesOn == true, mark checked on image
 			//for (int i = 0; i < allPts.size(); i++) {
@@ -193,35 +564,34 @@ bool pupilAreaFitRR(Mat &gray, RotatedRect &rr, vector<Point2f> &allPtsReturn,
 			return false;
 		}
 
-		//convert back to 3 channel for drawing if necessary
-		cv::cvtColor(gray, gray, CV_GRAY2BGR);
-
 		//remove outliers via ellipse method, basically a logical AND of candidate points with a drawn ellipse: great for removing outliers
-		thresh3 = Mat::zeros(size2, size2, CV_8U); //black mat
+		Mat &thresh3 = ws.thresh3;
+		thresh3.create(grayRoi.size(), CV_8U);
+		thresh3.setTo(Scalar(0)); //black mat
 		if (allPts.size() > 5) {
 			RotatedRect ellipseRaw = fitEllipse(allPts);
 
-			if (ellipseRaw.center.x < 300 && ellipseRaw.center.x > 0 && ellipseRaw.angle > 5) {
+			if (ellipseRaw.center.x < 300 * g.scale && ellipseRaw.center.x > 0 && ellipseRaw.angle > 5) {
 				//if possible and within bounds, draw
 				ellipse(thresh3, ellipseRaw, 255, 2, 8); //draw white ellipse 
 			}
-			allPts2 = getCandidates(allPtsWithOutliers, 0, thresh3, false);
+			allPts2 = getCandidates(allPtsWithOutliers, 0, thresh3, ws.debug, false);
 		}
 		else {
 			return false;
 		}
 
 		//re-run the ellipse method on a fitted ellipse, but with the original set of points: great for re-including inliers
-		thresh3 = Mat::zeros(size2, size2, CV_8U); //black mat
+		thresh3.setTo(Scalar(0)); //black mat
 		if (allPts2.size() > 5 && allPtsWithOutliers.size() > 0 && allPtsWithOutliers.at(0).size() > 5) {
 			RotatedRect ellipseRaw = fitEllipse(allPts2);
 
 			//check for impossible ellipses
-			if (ellipseRaw.center.x < size2 && ellipseRaw.center.x > 0 && ellipseRaw.angle > 5) {
+			if (ellipseRaw.center.x < grayRoi.cols && ellipseRaw.center.x > 0 && ellipseRaw.angle > 5) {
 				//if possible and within bounds, draw
 				ellipse(thresh3, ellipseRaw, 255, 2, 8); //draw white ellipse 
 			}
-			allPts = getCandidates(allPtsWithOutliers, 0, thresh3, false);
+			allPts = getCandidates(allPtsWithOutliers, 0, thresh3, ws.debug, false);
 
 
 
@@ -230,13 +600,9 @@ bool pupilAreaFitRR(Mat &gray, RotatedRect &rr, vector<Point2f> &allPtsReturn,
 			return false;
 		}
 
-		//convert to gray for refinement
-		cv::cvtColor(gray, gray, CV_BGR2GRAY);
-
 		//refine points based on line fitting - Thanks Yuta! 
 		if (allPts.size() > 5) {
-			allPts = refinePoints(allPts, gray(cv::Rect(darkestPixelConfirm.x, darkestPixelConfirm.y, size2, size2)),
-				10, 2, gray(cv::Rect(darkestPixelConfirm.x, darkestPixelConfirm.y, size2, size2)), true);
+			allPts = refinePoints(allPts, grayRoi, 10, 2, grayRoi, true);
 		}
 		else {
 			return false;
@@ -244,19 +610,20 @@ bool pupilAreaFitRR(Mat &gray, RotatedRect &rr, vector<Point2f> &allPtsReturn,
 
 		//re-refine with another ellipse fit
 		if (allPts.size() > 5) {
-			thresh3 = Mat::zeros(frameHeight, frameWidth, CV_8U);
+			thresh3.create(gray.size(), CV_8U);
+			thresh3.setTo(Scalar(0));
 			RotatedRect ellipseRaw = fitEllipse(allPts);
 			ellipse(thresh3, ellipseRaw, 255, 1, 8);
 
-			std::vector<std::vector<cv::Point> > ellipseContour;
+			std::vector<std::vector<cv::Point> > &ellipseContour = ws.ellipseContour;
+			ellipseContour.clear();
 			cv::findContours(thresh3, ellipseContour, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_NONE);
 
 			if (ellipseContour.size() > 0 && ellipseContour.at(0).size() > 5) {
-				thresh3 = Mat::zeros(frameHeight, frameWidth, CV_8U);
+				thresh3.setTo(Scalar(0));
 				RotatedRect ellipseRaw = fitEllipse(allPts);
 				ellipse(thresh3, ellipseRaw, 255, 1, 8);
-				allPts = refinePoints(ellipseContour.at(0), thresh3, 6, 2, 
-					gray(cv::Rect(darkestPixelConfirm.x, darkestPixelConfirm.y, size2, size2)), true);
+				allPts = refinePoints(ellipseContour.at(0), thresh3, 6, 2, grayRoi, true);
 			}
 
 			//temp = gray.clone();
@@ -268,10 +635,10 @@ bool pupilAreaFitRR(Mat &gray, RotatedRect &rr, vector<Point2f> &allPtsReturn,
 
 			/* //found that this additional refinement doesn't really help
 			if (ellipseContour.size() > 0 && ellipseContour.at(0).size() > 5) {
-				thresh3 = Mat::zeros(frameHeight, frameWidth, CV_8U);
+				thresh3 = Mat::zeros(gray.size(), CV_8U);
 				RotatedRect ellipseRaw = fitEllipse(allPts);
 				ellipse(thresh3, ellipseRaw, 255, 1, 8);
-				allPts = refinePoints(ellipseContour.at(0), thresh3, 8, 1, gray(cv::Rect(darkestPixelConfirm.x, darkestPixelConfirm.y, size2, size2)));
+				allPts = refinePoints(ellipseContour.at(0), thresh3, 8, 1, gray(window));
 			}
 			*/
 		}
@@ -297,59 +664,153 @@ bool pupilAreaFitRR(Mat &gray, RotatedRect &rr, vector<Point2f> &allPtsReturn,
 
 
 		///waitKey(1);
+		// Edge points of the fitted ellipse in image coordinates
 		for (int i = 0; i < allPts.size(); i++) {
-			allPtsReturn.push_back(Point2f(darkestPixelConfirm.x, darkestPixelConfirm.y));
+			allPtsReturn.push_back(Point2f(allPts[i].x + darkestPixelConfirm.x, allPts[i].y + darkestPixelConfirm.y));
 		}
 		rr = ellipseCorrect;
 		return true;
 	}
 
-private:
+/**
+Fits the pupil inside a window of the image: with fitPupilInWindow at full resolution, or in coarse-to-fine
+mode on the window scaled down to the reference resolution, after which the edge points found there are
+refined on the full resolution window and the ellipse is refitted to them
+@return true if a pupil was found; rr and the appended points are in image coordinates
+*/
+bool fitPupil(const Mat &gray, const Rect &window, const PupilGeometry &g, PupilFitterWorkspace &ws, RotatedRect &rr, vector<Point2f> &allPtsReturn) const
+{
+	const Size fineSize(cvRound(window.width / g.scale), cvRound(window.height / g.scale));
+	if (coarseToFine == false || g.scale < coarseToFineMinScale || fineSize.width <= 50 || fineSize.height <= 50) {
+		return fitPupilInWindow(gray, window, g, ws, rr, allPtsReturn);
+	}
+
+	//detect at the reference resolution
+	resize(gray(window), ws.fineInput, fineSize, 0, 0, INTER_AREA);
+	const PupilGeometry fineGeometry = geometry(Size(cvRound(g.frame.width / g.scale), cvRound(g.frame.height / g.scale)));
+	RotatedRect fineRect;
+	ws.finePts.clear();
+	if (fitPupilInWindow(ws.fineInput, Rect(Point(0, 0), fineSize), fineGeometry, ws, fineRect, ws.finePts) == false) {
+		return false;
+	}
+
+	//refine the edge points at full resolution, as far as the scaling may have moved them
+	const double sx = static_cast<double>(window.width) / fineSize.width;
+	const double sy = static_cast<double>(window.height) / fineSize.height;
+	vector<Point> &allPts = ws.allPts;
+	allPts.clear();
+	for (const Point2f &p : ws.finePts) {
+		allPts.push_back(Point(cvRound((p.x + 0.5) * sx - 0.5), cvRound((p.y + 0.5) * sy - 0.5)));
+	}
+	const Mat grayRoi = gray(window);
+	allPts = refinePoints(allPts, grayRoi, std::max(2, cvRound(2 * g.scale)), 1, grayRoi, true);
+	if (allPts.size() <= 5) {
+		return false;
+	}
+
+	const RotatedRect ellipseRaw = fitEllipse(allPts);
+	rr = RotatedRect(Point2f(ellipseRaw.center.x + window.x, ellipseRaw.center.y + window.y), ellipseRaw.size, ellipseRaw.angle);
+	for (const Point &p : allPts) {
+		allPtsReturn.push_back(Point2f(static_cast<float>(p.x + window.x), static_cast<float>(p.y + window.y)));
+	}
+	return true;
+}
+
+/**
+Window of the next temporal tracking search: the previous pupil moved on by its last motion,
+trackingWindowScale times its size plus the motion, at most the ROI size, clamped to the image
+*/
+Rect trackingWindow(const PupilGeometry &g, const PupilFitterWorkspace &ws) const
+{
+	const Size &image = g.frame;
+	const RotatedRect &previous = ws.previousRect;
+	const Point2f center = previous.center + ws.velocity;
+	const float motion = std::abs(ws.velocity.x) + std::abs(ws.velocity.y);
+	int side = cvRound(std::max(previous.size.width, previous.size.height) * trackingWindowScale + 2 * motion);
+	side = std::min(std::max(side, g.minWindow), g.size);
+	Rect window(cvRound(center.x) - side / 2, cvRound(center.y) - side / 2, side, side);
+	window.x = std::min(std::max(window.x, 0), image.width - side);
+	window.y = std::min(std::max(window.y, 0), image.height - side);
+	return window & Rect(0, 0, image.width, image.height);
+}
+
+/**
+Validates a pupil found by temporal tracking: a plausible ellipse, entirely inside the window
+(not cut off by it) and of about the size of the previous pupil
+*/
+bool isTrackedPupil(const RotatedRect &current, const Rect &window, const RotatedRect &previous, const PupilGeometry &g) const
+{
+	const Rect bounds = current.boundingRect();
+	if ((bounds & window) != bounds) {
+		return false;
+	}
+	return isPlausibleEllipse(current, g.minPupil, g.size) && isSimilarSize(current, previous);
+}
+
+/// Size and shape limits of a pupil ellipse
+bool isPlausibleEllipse(const RotatedRect &current, int minSize, int maxSize) const
+{
+	return current.size.width >= minSize && current.size.height >= minSize &&
+		current.size.width <= maxSize && current.size.height <= maxSize &&
+		current.size.width / current.size.height <= 2 && current.size.height / current.size.width <= 2;
+}
+
+/// Width and height within 30% of the previous ellipse's
+bool isSimilarSize(const RotatedRect &current, const RotatedRect &previous) const
+{
+	return current.size.height / previous.size.height <= 1.3 && previous.size.height / current.size.height <= 1.3 &&
+		current.size.width / previous.size.width <= 1.3 && previous.size.width / current.size.width <= 1.3;
+}
+
+/// Moves the temporal tracking state on by one frame
+void updateTracking(PupilFitterWorkspace &ws, bool isFound, const RotatedRect &current) const
+{
+	if (isFound == false) {
+		ws.isTracking = false;
+		ws.velocity = Point2f(0, 0);
+		return;
+	}
+	ws.velocity = ws.isTracking ? current.center - ws.previousRect.center : Point2f(0, 0);
+	ws.previousRect = current;
+	ws.isTracking = true;
+}
 //global variables  
 
-//Mats for holding various images
-Mat frame;
-Mat frame1;
-Mat frame2;
-Mat edges;
-
-//Mats for holding ROI images
-Mat thresh1;
-Mat thresh2;
-Mat thresh3;
-Mat thresh4;
-Mat threshLow;
-Mat threshMid;
-Mat threshHigh;
-Mat temp;
-
-//image height/width (note that the algorithm isn't adapted to 320x240 yet!!)
-int frameHeight = 480;
-int frameWidth = 640;
-
-//Mats for other functions: motion detection, resizing, etc
-Mat resizeF1;
-Mat resizeF2;
-Mat gray, detected_edges;
-
-//global params for setting, these should be set per-user
+//frame size the parameters are given for, see setReferenceFrameSize
+Size referenceSize = Size(640, 480);
+
+//global params for setting, these should be set per-user, see setParameters for their defaults
 int lowThresholdCanny = 10; //for detecting dark (low contrast) parts of pupil
-int highThresholdCanny = 60; //for detecting lighter (high contrast) parts of pupil
-int size = 280;//max L/H of pupil
-int darkestPixelL1 = 8; //for setting 
+int highThresholdCanny = 30; //for detecting lighter (high contrast) parts of pupil
+int size = 240;//max L/H of pupil
+int darkestPixelL1 = 10; //for setting 
 int darkestPixelL2 = 20;
-int pupilSearchArea = 20;
+int pupilSearchArea = 10;
 int pupilSearchXMin = 0;
 int pupilSearchYMin = 0;
-bool erodeOn = true;
+bool erodeOn = false;
+
+//coarse localisation, see setCoarseLocalisation
+bool denseLocalisation = false;
+int coarseScale = 4;
+
+//darkness threshold sampling, see setDarknessSampling
+int darknessSampleStep = 5;
+
+//coarse-to-fine detection on large frames, see setCoarseToFine
+bool coarseToFine = false;
+double coarseToFineMinScale = 1.25;
+
+//temporal tracking, see setTemporalTracking
+bool temporalTracking = false;
+float trackingWindowScale = 2.0f;
 
 //thickness for ANDing candidate points with Canny images: thicker = more candidates
 int thickness = 3;
 bool threshDebug = false;
 
-//rect for comparing previous frame, used in bad ellipse filtering process
-RotatedRect previousRect = RotatedRect(Point2f(0, 0), Size2f(0, 0), 0);
-vector<Point> allPts;
+//scratch state of the calls without a workspace argument
+PupilFitterWorkspace workspace;
 
 /**
 Finds the approximate darkets pixel, used on ROI images generated by getDarkestPixel area
@@ -357,40 +818,15 @@ Finds the approximate darkets pixel, used on ROI images generated by getDarkestP
 @param I2 copy of input image onto which green block of pixels is drawn (BGR), null ok
 @return a point within the pupil region
 */
-int getDarkestPixel(Mat& I)
+int getDarkestPixel(const Mat& I) const
 {
 	// accept only char type matrices
 	CV_Assert(I.depth() == CV_8U);
 
-	int channels = I.channels();
-
-	int min = 255;
-
-	int nRows = I.rows;
-	int nCols = I.cols * channels;
-
-	int nRowsT = I.rows;
-	int nColsT = I.cols * channels;
-
-	if (I.isContinuous())
-	{
-		nCols *= nRows;
-		nRows = 1;
-	}
-
-	int i, j;
-	uchar* p;
-	for (i = 0; i < nRows; i = i + 5)
-	{
-		p = I.ptr<uchar>(i);
-		for (j = 0; j < nCols; j = j + 5)
-		{
-			if (p[j] < min){
-				min = p[j];
-			}
-		}
-	}
-	return min;
+	//darkest of every 5th pixel of every 5th row
+	IntensityHistogram histogram;
+	histogram.add(I, 5);
+	return histogram.nth(0);
 }
 
 /**
@@ -541,71 +977,110 @@ Finds the approximate darkest pixels (an average of many), used on ROI images ge
 @param I input image (converted to grayscale during search process)
 @return a grayscale value
 */
-int getDarkestPixelBetter(Mat& I)
+int getDarkestPixelBetter(const Mat& I) const
 {
 	// accept only char type matrices
 	CV_Assert(I.depth() == CV_8U);
 	CV_Assert(I.size().width > 50);
 	CV_Assert(I.size().height > 50);
 
-	int channels = I.channels();
-
-	int min = 255;
-	float minDenominator = 0;
-	float minNumerator = 0;
-
-	//holds array of 50 min values
-	vector<float> minVector;
-
-	int nRows = I.rows;
-	int nCols = I.cols * channels;
-
-	int nRowsT = I.rows;
-	int nColsT = I.cols * channels;
+	//1st percentile of the sampled pixels (HxW of orig image must be > 50)
+	IntensityHistogram histogram;
+	histogram.add(I, darknessSampleStep, 2);
+	return histogram.nth(histogram.count / 100);
+}
 
-	if (I.isContinuous())
-	{
-		nCols *= nRows;
-		nRows = 1;
+/**
+Finds a square area of dark pixels in the image.
+Sums the image in coarseScale x coarseScale blocks around the search area and scores every block centre with
+the sum of the square around it, read from the integral image of the block sums in one dense pass. Same search
+area and square (61x61 at 640x480) as getDarkestPixelAreaSampled, but every position on a coarseScale grid and
+every pixel of the square are evaluated. Both scale with the frame size, so the block grid has about the same
+size at every resolution.
+@param I 8 bit single channel input image
+@param g spatial constants for the size of I
+@return the centre of the darkest square, (0, 0) if the image is too small to search
+*/
+Point getDarkestPixelArea(const Mat& I, const PupilGeometry &g, PupilFitterWorkspace &ws) const
+{
+	// accept only char type matrices
+	CV_Assert(I.depth() == CV_8U && I.channels() == 1);
+
+	const int scale = g.coarseScale;
+	const int width = g.darkSquare; //half width of the darkness square, in full resolution pixels
+	const int r = std::max(1, width / scale); //half width in blocks
+	const int side = 2 * r + 1;
+
+	//centre of a block in full resolution coordinates
+	auto toFull = [scale](int c) { return c * scale + scale / 2; };
+
+	//range of block centres [y0, y1) x [x0, x1): the square lies inside the image and the centre inside the search area
+	int y0 = r, y1 = I.rows / scale - r;
+	int x0 = r, x1 = I.cols / scale - r;
+	//in our videos, pupils are below y=60 and left of x=530 (at 640x480), remove for videos where pupil could be anywhere on the screen
+	while (y0 < y1 && (toFull(y0) < width + g.searchMin.y || toFull(y0) <= g.searchTop)) y0++;
+	while (y1 > y0 && toFull(y1 - 1) >= I.rows - width) y1--;
+	while (x0 < x1 && toFull(x0) < width + g.searchMin.x) x0++;
+	while (x1 > x0 && (toFull(x1 - 1) >= I.cols - width || toFull(x1 - 1) >= g.searchRight)) x1--;
+	if (y0 >= y1 || x0 >= x1) {
+		return Point();
 	}
 
-	int i, j;
-	uchar* p;
-	for (i = 2; i < nRows - 2; i = i + 5)
-	{
-		p = I.ptr<uchar>(i);
-		for (j = 2; j < nCols - 2; j = j + 5)
-		{
-			minVector.push_back(p[j]);
-			if ((p[j] + p[j - 2] + p[j + 2]) / 3 < min) {
-				min = p[j];
+	//integral image of the block sums under the squares of the search area, straight from the full resolution
+	//rows: no downsampled copy of the frame and only the pixels a square can reach are read
+	const int rows = y1 - y0 + 2 * r, cols = x1 - x0 + 2 * r;
+	const int pixels = cols * scale;
+	ws.coarseIntegral.create(rows + 1, cols + 1, CV_32S);
+	ws.coarseIntegral.row(0).setTo(Scalar(0));
+	ws.coarseRow.resize(pixels);
+	for (int y = 0; y < rows; y++) {
+		ushort* column = &ws.coarseRow[0];
+		std::fill(column, column + pixels, ushort(0));
+		for (int k = 0; k < scale; k++) {
+			const uchar* in = I.ptr<uchar>((y0 - r + y) * scale + k) + (x0 - r) * scale;
+			for (int x = 0; x < pixels; x++) {
+				column[x] += in[x];
+			}
+		}
+		const int* above = ws.coarseIntegral.ptr<int>(y);
+		int* out = ws.coarseIntegral.ptr<int>(y + 1);
+		int rowSum = 0;
+		out[0] = 0;
+		for (int x = 0; x < cols; x++) {
+			for (int k = 0; k < scale; k++) {
+				rowSum += column[x * scale + k];
 			}
+			out[x + 1] = above[x + 1] + rowSum;
 		}
 	}
 
+	//darkness of every centre: four reads of the integral image per position
+	int minVal = std::numeric_limits<int>::max();
+	Point minLoc;
+	for (int y = 0; y < y1 - y0; y++) {
+		const int* top = ws.coarseIntegral.ptr<int>(y);
+		const int* bottom = ws.coarseIntegral.ptr<int>(y + side);
+		for (int x = 0; x < x1 - x0; x++) {
+			const int darkness = bottom[x + side] - bottom[x] - top[x + side] + top[x];
+			if (darkness < minVal) {
+				minVal = darkness;
+				minLoc = Point(x, y);
+			}
+		}
+	}
 
-	//average last 50 values in minVector and set that to min (HxW of orig image must be > 50)
-	//min = (int)(minDenominator / minNumerator);
-	sort(minVector.begin(), minVector.end());
-	min = minVector.at(minVector.size() / 100);
-
-
-	return min;
+	return Point(toFull(x0 + minLoc.x), toFull(y0 + minLoc.y));
 }
 
 /**
-Finds a square area of dark pixels in the image
-@param I input image (converted to grayscale during search process)
-@param I2 copy of input image onto which green block of pixels is drawn (BGR), null ok
+Finds a square area of dark pixels in the image by sampling a 7x7 lattice of the square around every
+position of a 10 pixel grid (at 640x480). The default coarse localisation, see setCoarseLocalisation
+@param I 8 bit single channel input image
+@param g spatial constants for the size of I
 @return a point within the pupil region
 */
-Point getDarkestPixelArea(Mat& I)
+Point getDarkestPixelAreaSampled(const Mat& I, const PupilGeometry &g) const
 {
-	assert(I.channels() == 3 || I.channels() == 1);
-	if (I.channels() == 3) {
-		cv::cvtColor(I, I, CV_BGR2GRAY);
-	}
-
 	// accept only char type matrices
 	CV_Assert(I.depth() == CV_8U);
 
@@ -614,11 +1089,11 @@ Point getDarkestPixelArea(Mat& I)
 	int channels = I.channels();
 
 	//for searching image
-	int sArea = 20; //bound of outer search in any direction
+	int sArea = std::max(2, cvRound(20 * g.scale)); //bound of outer search in any direction
 	int outerSearchDivisor = 2; //sets spacing of outer search, equal to sArea*2/outerSearchDivisor
 
 	//darkness calculation
-	int width = 30; //width of darkness search area (default 20)
+	int width = std::max(3, g.darkSquare); //width of darkness search area (default 20)
 	int searchDivisor = 3;
 
 	//stdev calculation
@@ -634,8 +1109,12 @@ Point getDarkestPixelArea(Mat& I)
 	bool draw = true;
 	int finalColorCount = 0;
 
-	for (int i = sArea * width / sArea + pupilSearchYMin; i < I.rows - sArea* width / sArea; i = i + sArea / outerSearchDivisor){
-		for (int j = sArea* width / sArea + pupilSearchXMin; j < I.cols - sArea* width / sArea; j = j + sArea / outerSearchDivisor){
+	//spacing of the 7x7 lattice of the darkness square; it scales with the square, the lattice size is fixed
+	const int latticeStep = width / searchDivisor;
+	const int latticeRowStep = latticeStep * static_cast<int>(I.step);
+
+	for (int i = sArea * width / sArea + g.searchMin.y; i < I.rows - sArea* width / sArea; i = i + sArea / outerSearchDivisor){
+		for (int j = sArea* width / sArea + g.searchMin.x; j < I.cols - sArea* width / sArea; j = j + sArea / outerSearchDivisor){
 
 			int tempSum = 0; //holds current sum of pixel intensities
 			float tempStDev = 1000;
@@ -643,14 +1122,16 @@ Point getDarkestPixelArea(Mat& I)
 			int colorCount = 0; //counts the number of pixels summed
 
 			//darkness testing for single square
-			for (int d = -width; d < width + 1; d = d + width / searchDivisor){
-				for (int c = -width; c < width + 1; c = c + width / searchDivisor){
+			const uchar* centre = I.ptr<uchar>(i) + j;
+			for (int d = -searchDivisor; d < searchDivisor + 1; d++){
+				const uchar* row = centre + d * latticeRowStep;
+				for (int c = -searchDivisor; c < searchDivisor + 1; c++){
 
-					if (d == -width&&c == -width || d == width&&c == -width || d == -width&&c == width || d == width&&c == width){
+					if ((d == -searchDivisor || d == searchDivisor) && (c == -searchDivisor || c == searchDivisor)){
 						//no comparison at corners
 					}
 					else{
-						tempSum += I.at<uchar>(i + d, j + c);
+						tempSum += row[c * latticeStep];
 					}
 
 					//for efficiency, exit if darkness > current 
@@ -688,7 +1169,7 @@ Point getDarkestPixelArea(Mat& I)
 				//tempStDev = standard_deviation(&data[0], data.size());
 
 				//in our videos, pupils don't exceed y>160 or x>530, remove for videos where pupil could be anywhere on the screen 
-				if (i > 60 && j < 530){
+				if (i > g.searchTop && j < g.searchRight){
 
 					ROI = Point(j, i);
 					//cout << "tempsum = " << tempSum << " @ " << j << ", " << i << endl;
@@ -723,7 +1204,7 @@ Point getDarkestPixelArea(Mat& I)
 	return ROI;
 }
 
-Point correctBounds(Point input, int maxSize){
+Point correctBounds(Point input, int maxSize, const Size &frame) const{
 
 	//maximum size (L or W) of pupil ROI
 	int size = maxSize;
@@ -739,16 +1220,16 @@ Point correctBounds(Point input, int maxSize){
 	if (newX < 0){
 		newX += -newX;
 	}
-	else if (newX > 639 - size){
-		newX -= newX - 639 + size;
+	else if (newX > frame.width - 1 - size){
+		newX -= newX - (frame.width - 1) + size;
 		//std::cout << "oops" << endl;
 	}
 
 	if (newY < 0){
 		newY += -newY;
 	}
-	else if (newY > 479 - size){
-		newY -= newY - 479 + size;
+	else if (newY > frame.height - 1 - size){
+		newY -= newY - (frame.height - 1) + size;
 		//std::cout << "oops2" << endl;
 	}
 
@@ -757,7 +1238,7 @@ Point correctBounds(Point input, int maxSize){
 
 }
 
-vector<int> getBiggest(std::vector<std::vector<cv::Point>> contours){
+vector<int> getBiggest(const std::vector<std::vector<cv::Point>> &contours, const PupilGeometry &g) const{
 
 	vector<int> biggestOutVec;
 	int biggestOut = 0;
@@ -786,7 +1267,7 @@ vector<int> getBiggest(std::vector<std::vector<cv::Point>> contours){
 
 		//find contour with largest area and use it as the pupil
 		for (int i = 0; i < mc.size(); i++){
-			if (contours[i].size() > 40 && mc[i].y > 10 && mc[i].x < 620){
+			if (contours[i].size() > 40 * g.scale && mc[i].y > 10 * g.scale && mc[i].x < 620 * g.scale){
 
 				int area = (int)contourArea(contours[i]);
 
@@ -806,9 +1287,10 @@ vector<int> getBiggest(std::vector<std::vector<cv::Point>> contours){
 }
 
 /**
-* Gets candidate points from a list of contours and canny image
+* Gets candidate points from a list of contours and canny image.
+* Found points are cleared in thresh; with draw set they are marked on the BGR image frame2
 */
-vector<Point> getCandidates(std::vector<std::vector<cv::Point>>contours, int biggest, Mat& thresh, bool draw){
+vector<Point> getCandidates(const std::vector<std::vector<cv::Point>> &contours, int biggest, Mat& thresh, Mat& frame2, bool draw) const{
 
 	vector<Point> allPts;
 
@@ -915,7 +1397,7 @@ vector<Point> getCandidates(std::vector<std::vector<cv::Point>>contours, int big
 
 //Point refinement code
 //Better fits a set of candidate points to a pupil ellipse
-vector<Point> refinePoints(vector<Point> allPts, Mat gray, int checkThickness, int checkSpacing, Mat grayOriginal, bool rmOutliers = false){
+vector<Point> refinePoints(const vector<Point> &allPts, const Mat &gray, int checkThickness, int checkSpacing, const Mat &grayOriginal, bool rmOutliers = false) const{
 
 	//vector holding returned points with sub-pixel accuracy
 	vector<Point> refinedPoints;
@@ -1007,31 +1489,28 @@ vector<Point> refinePoints(vector<Point> allPts, Mat gray, int checkThickness, i
 }//end point refinement
 
 bool badEllipseFilter(RotatedRect current, int maxSize){
+	return badEllipseFilter(current, maxSize, workspace);
+}
+
+bool badEllipseFilter(RotatedRect current, int maxSize, PupilFitterWorkspace &ws) const{
+	const RotatedRect &previousRect = ws.previousRect;
 
 	bool isGood = true;
 
 	//test against last ttwo ellipse sizes and rotations, 
 	//if difference is over a certain size and angle threshold, set isGood to false 
-	if (current.size.width / current.size.height > 2 ||
-		current.size.height / current.size.width > 2 ||
-		current.size.height > maxSize ||
-		current.size.width > maxSize ||
-		current.size.height < 10 ||
-		current.size.width < 10 ||
-		current.size.width > maxSize ||
-		current.size.height > maxSize ||
+	if (isPlausibleEllipse(current, 10, maxSize) == false ||
 		//current.center.y < 40 ||
-		current.size.height / previousRect.size.height > 1.3 ||
-		previousRect.size.height / current.size.height > 1.3 ||
-		current.size.width / previousRect.size.width > 1.3 ||
-		previousRect.size.width / current.size.width > 1.3){
+		isSimilarSize(current, previousRect) == false){
 		cout << "returning false" << endl;
 		isGood = false;
 	}
 
-	previousRect = current;
+	ws.previousRect = current;
 
 	return isGood;
 }
 
 };
+
+#endif // PUPIL_FITTER_H
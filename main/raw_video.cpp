@@ -0,0 +1,199 @@
+#include "raw_video.h"
+
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace eye_tracker
+{
+
+namespace {
+const char kRawVideoMagic[8] = { 'E', 'Y', 'E', 'R', 'A', 'W', '\0', '\1' };
+
+uint64_t alignUp(uint64_t size, uint64_t alignment){
+	return (size + alignment - 1) / alignment * alignment;
+}
+}
+
+bool convert_to_raw_video(const std::string &video_file, const std::string &raw_file, PixelFormat format){
+	cv::VideoCapture cap(video_file);
+	if (cap.isOpened() == false){
+		std::cout << "convert_to_raw_video: could not open " << video_file << std::endl;
+		return false;
+	}
+	double fps = cap.get(CV_CAP_PROP_FPS);
+	if (fps <= 0) fps = 30;
+
+	RawVideoWriter writer;
+	cv::Mat img, mono;
+	uint64_t frame_count = 0;
+	while (cap.read(img)){
+		if (writer.isOpened() == false && writer.open(raw_file, img.size(), format, fps) == false){
+			return false;
+		}
+		const cv::Mat *out = &img;
+		if (format == PixelFormat::Y8 && img.channels() != 1){
+			cv::cvtColor(img, mono, CV_BGR2GRAY);
+			out = &mono;
+		}
+		// Timestamps from the nominal frame rate; container timestamps are not reliable across codecs
+		const int64_t timestamp_us = static_cast<int64_t>(frame_count * 1e6 / fps + 0.5);
+		if (writer.write(*out, timestamp_us) == false){
+			return false;
+		}
+		frame_count++;
+	}
+	writer.close();
+	std::cout << "convert_to_raw_video: " << frame_count << " frames from " << video_file << " to " << raw_file << std::endl;
+	return frame_count > 0;
+}
+
+// RawVideoWriter //////////////////////////////////////////////////////
+
+RawVideoWriter::RawVideoWriter(const std::string &file_name, const cv::Size &size, PixelFormat format, double fps){
+	open(file_name, size, format, fps);
+}
+RawVideoWriter::~RawVideoWriter(){
+	close();
+}
+
+bool RawVideoWriter::open(const std::string &file_name, const cv::Size &size, PixelFormat format, double fps){
+	close();
+	file_.open(file_name, std::ios::binary | std::ios::trunc);
+	if (file_.is_open() == false){
+		std::cout << "RawVideoWriter: could not open " << file_name << std::endl;
+		return false;
+	}
+	const uint64_t channels = (format == PixelFormat::Y8) ? 1 : 3;
+	std::memset(&header_, 0, sizeof(header_));
+	std::memcpy(header_.magic, kRawVideoMagic, sizeof(header_.magic));
+	header_.header_size = kHeaderSize;
+	header_.width = size.width;
+	header_.height = size.height;
+	header_.format = (format == PixelFormat::Y8) ? 1 : 0;
+	header_.frame_stride = alignUp(size.width * channels * size.height, kFrameAlignment);
+	header_.fps = fps;
+	timestamps_.clear();
+
+	// Placeholder header, completed by close()
+	padding_.assign(kHeaderSize, 0);
+	std::memcpy(padding_.data(), &header_, sizeof(header_));
+	file_.write(padding_.data(), kHeaderSize);
+	return file_.good();
+}
+
+bool RawVideoWriter::write(const Frame &frame){
+	if (header_.frame_count == 0){
+		first_capture_time_ = frame.info.capture_time;
+	}
+	const int64_t timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(frame.info.capture_time - first_capture_time_).count();
+	return write(frame.image, timestamp_us);
+}
+
+bool RawVideoWriter::write(const cv::Mat &image, int64_t timestamp_us){
+	if (isOpened() == false) return false;
+	const int expected_type = (header_.format == 1) ? CV_8UC1 : CV_8UC3;
+	if (image.cols != (int)header_.width || image.rows != (int)header_.height || image.type() != expected_type){
+		std::cout << "RawVideoWriter: frame size/format does not match the file" << std::endl;
+		return false;
+	}
+	const size_t row_bytes = image.cols * image.elemSize();
+	if (image.isContinuous()){
+		file_.write(reinterpret_cast<const char*>(image.data), row_bytes * image.rows);
+	}
+	else{
+		for (int y = 0; y < image.rows; y++){
+			file_.write(reinterpret_cast<const char*>(image.ptr(y)), row_bytes);
+		}
+	}
+	const size_t pad = static_cast<size_t>(header_.frame_stride - row_bytes * image.rows);
+	if (pad > 0){
+		padding_.assign(pad, 0);
+		file_.write(padding_.data(), pad);
+	}
+	timestamps_.push_back(timestamp_us);
+	header_.frame_count++;
+	return file_.good();
+}
+
+void RawVideoWriter::close(){
+	if (isOpened() == false) return;
+	header_.timestamps_offset = header_.header_size + header_.frame_count * header_.frame_stride;
+	if (timestamps_.empty() == false){
+		file_.write(reinterpret_cast<const char*>(timestamps_.data()), timestamps_.size() * sizeof(int64_t));
+	}
+	file_.seekp(0);
+	file_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+	file_.close();
+}
+
+// EyeCameraRaw ////////////////////////////////////////////////////////
+
+EyeCameraRaw::EyeCameraRaw(const std::string &file_name, bool is_paced)
+	: is_paced_(is_paced)
+{
+	std::cout << "EyeCameraRaw: Open a raw video file: " << file_name << std::endl;
+	try{
+		try{
+			file_ = boost::interprocess::file_mapping(file_name.c_str(), boost::interprocess::read_only);
+			region_ = boost::interprocess::mapped_region(file_, boost::interprocess::copy_on_write);
+		}
+		catch (const boost::interprocess::interprocess_exception &){
+			throw "EyeCameraRaw: file open error";
+		}
+		if (region_.get_size() < sizeof(RawVideoHeader)){
+			throw "EyeCameraRaw: file is too small";
+		}
+		const unsigned char *base = static_cast<const unsigned char*>(region_.get_address());
+		std::memcpy(&header_, base, sizeof(header_));
+		if (std::memcmp(header_.magic, kRawVideoMagic, sizeof(header_.magic)) != 0){
+			throw "EyeCameraRaw: not a raw eye video";
+		}
+		if (header_.timestamps_offset < header_.header_size + header_.frame_count * header_.frame_stride ||
+			header_.timestamps_offset + header_.frame_count * sizeof(int64_t) > region_.get_size()){
+			throw "EyeCameraRaw: truncated file";
+		}
+	}
+	catch (const char *c){
+		std::cout << c << std::endl;
+		throw;
+	}
+	const unsigned char *base = static_cast<const unsigned char*>(region_.get_address());
+	frames_ = base + header_.header_size;
+	timestamps_ = reinterpret_cast<const int64_t*>(base + header_.timestamps_offset);
+	type_ = (header_.format == 1) ? CV_8UC1 : CV_8UC3;
+	pixel_format_ = (header_.format == 1) ? PixelFormat::Y8 : PixelFormat::BGR8;
+	std::cout << "EyeCameraRaw: " << header_.width << "x" << header_.height << ", " << header_.frame_count
+		<< " frames, " << header_.fps << " fps" << std::endl;
+}
+
+void EyeCameraRaw::seek(uint64_t index){
+	next_frame_ = index;
+	replay_start_ = Clock::time_point();
+}
+
+void EyeCameraRaw::fetchFrame(Frame &frame){
+	if (next_frame_ >= header_.frame_count){
+		frame.image.release(); // End of stream
+		return;
+	}
+	if (is_paced_){
+		if (replay_start_ == Clock::time_point()){
+			replay_start_ = Clock::now() - std::chrono::microseconds(timestamps_[next_frame_]);
+		}
+		std::this_thread::sleep_until(replay_start_ + std::chrono::microseconds(timestamps_[next_frame_]));
+	}
+	// The mapping is copy-on-write, so the header can point to it directly
+	unsigned char *data = const_cast<unsigned char*>(frames_ + next_frame_ * header_.frame_stride);
+	cv::Mat mapped(header_.height, header_.width, type_, data);
+	if (pixel_format_ == PixelFormat::Y8 && type_ != CV_8UC1){
+		convertToMono(mapped, frame.image);
+	}
+	else{
+		frame.image = mapped;
+	}
+	next_frame_++;
+	stampFrame(frame);
+}
+
+} // namespace
@@ -0,0 +1,120 @@
+#ifndef RAW_VIDEO_H
+#define RAW_VIDEO_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "eye_cameras.h"
+
+namespace eye_tracker
+{
+bool convert_to_raw_video(const std::string &video_file, const std::string &raw_file, PixelFormat format = PixelFormat::Y8);
+
+/// File extension of raw eye videos
+const std::string kRawVideoExtension = ".eyeraw";
+
+/**
+* @brief Header at the start of a raw eye video file.
+*
+* Layout: header (padded to header_size) | frame_count frames, frame_stride
+* bytes apart | frame_count int64 timestamps. Frames are stored uncompressed
+* with rows packed (width * channels bytes per row), and every frame starts on
+* a 64 byte boundary so a memory-mapped frame can be used in place.
+*/
+struct RawVideoHeader {
+	char magic[8];              ///< kRawVideoMagic
+	uint32_t header_size;       ///< Offset of the first frame
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;            ///< PixelFormat of all frames: 0 BGR8, 1 Y8
+	uint64_t frame_stride;      ///< Bytes from the start of one frame to the next
+	uint64_t frame_count;
+	uint64_t timestamps_offset; ///< Offset of the capture timestamps, microseconds since the first frame
+	double fps;                 ///< Nominal frame rate of the recording
+};
+
+/**
+* @class RawVideoWriter
+* @brief Writes frames into a raw eye video file. The frame count and the
+* timestamp table are completed by close()
+*/
+class RawVideoWriter
+{
+public:
+	static const uint32_t kHeaderSize = 4096; // One page, so that mapped frames are page aligned
+	static const uint64_t kFrameAlignment = 64;
+
+	RawVideoWriter() {}
+	RawVideoWriter(const std::string &file_name, const cv::Size &size, PixelFormat format, double fps);
+	~RawVideoWriter();
+
+	bool open(const std::string &file_name, const cv::Size &size, PixelFormat format, double fps);
+	bool isOpened() const { return file_.is_open(); }
+	/// Appends a frame, time stamped with its capture time relative to the first written frame
+	bool write(const Frame &frame);
+	/// Appends an image with an explicit timestamp in microseconds
+	bool write(const cv::Mat &image, int64_t timestamp_us);
+	void close();
+	uint64_t frameCount() const { return header_.frame_count; }
+
+protected:
+	std::ofstream file_;
+	RawVideoHeader header_;
+	std::vector<int64_t> timestamps_;
+	Clock::time_point first_capture_time_;
+	std::vector<char> padding_;
+private:
+	// Prevent copying
+	RawVideoWriter(const RawVideoWriter& other);
+	RawVideoWriter& operator=(const RawVideoWriter& rhs);
+};
+
+/**
+* @class EyeCameraRaw
+* @brief Replays a raw eye video from a memory-mapped file.
+*
+* Nothing is decoded or copied: fetchFrame hands out a cv::Mat header that
+* points into the mapping, valid as long as the source lives. The mapping is
+* copy-on-write, so an in-place operation on a delivered frame never changes
+* the file. Only a Y8 request on a BGR8 file converts the frame.
+* With is_paced the frames are delivered at their recorded timestamps,
+* otherwise as fast as they are fetched.
+*/
+class EyeCameraRaw : public EyeCameraParent
+{
+public:
+	EyeCameraRaw(const std::string &file_name, bool is_paced = false);
+	~EyeCameraRaw() {
+	}
+	bool isOpened() { return frames_ != nullptr; }
+	void fetchFrame(Frame &frame);
+
+	uint64_t frameCount() const { return header_.frame_count; }
+	double fps() const { return header_.fps; }
+	cv::Size size() const { return cv::Size(header_.width, header_.height); }
+	/// Recorded capture time of a frame in microseconds since the first frame
+	int64_t timestamp(uint64_t index) const { return timestamps_[index]; }
+	/// Sets the index of the next frame to deliver
+	void seek(uint64_t index);
+
+protected:
+	boost::interprocess::file_mapping file_;
+	boost::interprocess::mapped_region region_;
+	RawVideoHeader header_;
+	int type_ = CV_8UC1;
+	const unsigned char *frames_ = nullptr;
+	const int64_t *timestamps_ = nullptr;
+	uint64_t next_frame_ = 0;
+	bool is_paced_ = false;
+	Clock::time_point replay_start_;
+private:
+	// Prevent copying
+	EyeCameraRaw(const EyeCameraRaw& other);
+	EyeCameraRaw& operator=(const EyeCameraRaw& rhs);
+};
+
+} // namespace
+#endif // RAW_VIDEO_H
@@ -0,0 +1,77 @@
+#include "result_renderer.h"
+
+#include <opencv2/highgui/highgui.hpp>
+
+namespace eye_tracker
+{
+
+ResultRenderer::ResultRenderer(const std::vector<CameraTracker*> &trackers, const std::vector<std::string> &window_names, double display_rate)
+	: trackers_(trackers), window_names_(window_names), display_rate_(display_rate > 0 ? display_rate : 60),
+	ring_(FramePolicy::LATEST_FRAME), canvases_(trackers.size()), key_(0), is_running_(true)
+{
+	ring_.preallocate([&](std::vector<TrackedFrame> &slot){ slot.resize(trackers_.size()); });
+	thread_ = std::thread(&ResultRenderer::run, this);
+}
+
+ResultRenderer::~ResultRenderer(){
+	is_running_ = false;
+	if (thread_.joinable()) thread_.join();
+}
+
+void ResultRenderer::submit(const std::vector<TrackedFrame> &tracked){
+	std::vector<TrackedFrame> *slot = ring_.acquire_write();
+	for (size_t cam = 0; cam < slot->size() && cam < tracked.size(); cam++){
+		const TrackedFrame &src = tracked[cam];
+		TrackedFrame &dst = (*slot)[cam];
+		dst.is_undistorted = src.is_undistorted;
+		dst.detection = src.detection; // Reuses the capacity of the inlier vector
+		dst.sample = src.sample;
+		dst.fitter_count = src.fitter_count;
+		dst.fitter_end_count = src.fitter_end_count;
+		// Image sources and the tracker write the next frame into the same buffers, so the image
+		// that is displayed is copied into the slot's own buffer, which is reused once it has the frame size
+		const Frame &shown = src.is_undistorted ? src.grey : src.frame;
+		Frame &copy = src.is_undistorted ? dst.grey : dst.frame;
+		copy.info = shown.info;
+		shown.image.copyTo(copy.image);
+	}
+	ring_.commit_write();
+}
+
+RenderStatistics ResultRenderer::statistics() const{
+	RenderStatistics stats;
+	stats.submitted = ring_.pushed();
+	stats.rendered = ring_.popped();
+	stats.dropped = ring_.overwritten();
+	return stats;
+}
+
+void ResultRenderer::run(){
+	const Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / display_rate_));
+	Clock::time_point next_redraw = Clock::now();
+	while (is_running_){
+		std::vector<TrackedFrame> *tracked = ring_.acquire_read();
+		if (tracked != nullptr){
+			for (size_t cam = 0; cam < trackers_.size(); cam++){
+				const TrackedFrame &t = (*tracked)[cam];
+				if ((t.is_undistorted ? t.grey : t.frame).empty()) continue;
+				// The model is updated on the tracking thread, so only the results themselves are drawn
+				trackers_[cam]->render(t, canvases_[cam], false);
+				cv::imshow(window_names_[cam], canvases_[cam]);
+			}
+			ring_.release_read();
+		}
+		// Also pumps the window events
+		const int key = cv::waitKey(1);
+		if (key > 0) key_ = key;
+
+		next_redraw += period;
+		const Clock::time_point now = Clock::now();
+		if (next_redraw < now) {
+			next_redraw = now; // Fell behind, do not try to catch up
+		}
+		std::this_thread::sleep_until(next_redraw);
+	}
+}
+
+} // namespace
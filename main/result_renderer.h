@@ -0,0 +1,67 @@
+#ifndef RESULT_RENDERER_H
+#define RESULT_RENDERER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include "frame_ring.h"
+#include "camera_tracker.h"
+
+namespace eye_tracker
+{
+
+/// Counters of a ResultRenderer
+struct RenderStatistics {
+	size_t submitted = 0; ///< Results passed to submit()
+	size_t rendered = 0;  ///< Results drawn and shown
+	size_t dropped = 0;   ///< Results replaced by a newer one before they were drawn
+};
+
+/**
+* @class ResultRenderer
+* @brief Draws and shows tracking results on its own thread at display rate.
+*
+* The tracking loop hands each tick's results to submit(), which copies them
+* into a preallocated triple buffer (FrameRing, LATEST_FRAME) and returns: it
+* never waits and, once the buffers have grown to the frame size, never
+* allocates. The render thread wakes up at the display rate, draws only the
+* newest results and drops the ones it missed. HighGUI runs entirely on the
+* render thread, including cv::waitKey(); keys are passed back through takeKey().
+*/
+class ResultRenderer
+{
+public:
+	/**
+	@param trackers trackers of the cameras, used to draw their results; one window per tracker
+	@param window_names window title of each camera
+	@param display_rate redraws per second
+	*/
+	ResultRenderer(const std::vector<CameraTracker*> &trackers, const std::vector<std::string> &window_names, double display_rate = 60);
+	~ResultRenderer();
+
+	/// Publishes the results of one tick, one per camera. Never blocks. Call from one thread only
+	void submit(const std::vector<TrackedFrame> &tracked);
+	/// Returns the last key pressed in a window, or 0
+	char takeKey() { return static_cast<char>(key_.exchange(0)); }
+	RenderStatistics statistics() const;
+
+protected:
+	void run();
+
+	const std::vector<CameraTracker*> trackers_;
+	const std::vector<std::string> window_names_;
+	const double display_rate_;
+	FrameRing<std::vector<TrackedFrame>> ring_;
+	std::vector<cv::Mat> canvases_; // Drawing targets, reused from redraw to redraw
+	std::atomic<int> key_;
+	std::atomic<bool> is_running_;
+	std::thread thread_;
+private:
+	// Prevent copying
+	ResultRenderer(const ResultRenderer& other);
+	ResultRenderer& operator=(const ResultRenderer& rhs);
+};
+
+} // namespace
+#endif // RESULT_RENDERER_H
@@ -0,0 +1,162 @@
+#include "stream_recorder.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+namespace eye_tracker
+{
+
+StreamRecorder::StreamRecorder(const RecorderOptions &options)
+	: options_(options), written_(0)
+{
+	writer_thread_ = std::thread(&StreamRecorder::write_loop, this);
+	if (options_.write_images){
+		const int n = options_.image_encoder_threads < 1 ? 1 : options_.image_encoder_threads;
+		for (int i = 0; i < n; i++){
+			encoder_threads_.emplace_back(&StreamRecorder::encode_loop, this);
+		}
+	}
+}
+
+StreamRecorder::~StreamRecorder(){
+	stop();
+}
+
+bool StreamRecorder::record(const Frame &frame){
+	if (frame.empty()) return false;
+	Item item;
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (is_stopping_) return false;
+		stats_.submitted++;
+		if (queue_.size() + reserved_ >= options_.queue_capacity){
+			if (options_.block_when_full == false){
+				stats_.dropped++;
+				return false;
+			}
+			stats_.blocked++;
+			const Clock::time_point start = Clock::now();
+			queue_cv_.wait(lock, [this]{ return queue_.size() + reserved_ < options_.queue_capacity || is_stopping_; });
+			stats_.blocked_ms += millisecondsSince(start);
+			if (is_stopping_) return false;
+		}
+		reserved_++; // Holds the queue space while the frame is copied without the lock
+		item.index = next_index_++;
+	}
+
+	item.frame.info = frame.info;
+	frame.image.copyTo(item.frame.image);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		reserved_--;
+		queue_.push_back(std::move(item));
+		if (queue_.size() > stats_.queue_peak) stats_.queue_peak = queue_.size();
+	}
+	queue_cv_.notify_all();
+	return true;
+}
+
+void StreamRecorder::stop(){
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (is_stopping_ && writer_thread_.joinable() == false) return;
+		is_stopping_ = true;
+	}
+	queue_cv_.notify_all();
+	if (writer_thread_.joinable()) writer_thread_.join();
+	image_queue_cv_.notify_all();
+	for (auto &t : encoder_threads_){
+		if (t.joinable()) t.join();
+	}
+	encoder_threads_.clear();
+	if (video_writer_.isOpened()) video_writer_.release();
+	raw_writer_.close();
+
+	const RecorderStatistics stats = statistics();
+	std::cout << "StreamRecorder: " << options_.stem << ": written=" << stats.written << ", dropped=" << stats.dropped
+		<< ", blocked=" << stats.blocked << " (" << stats.blocked_ms << " ms), queue peak=" << stats.queue_peak << std::endl;
+}
+
+RecorderStatistics StreamRecorder::statistics() const{
+	std::lock_guard<std::mutex> lock(mutex_);
+	RecorderStatistics stats = stats_;
+	stats.written = written_;
+	return stats;
+}
+
+void StreamRecorder::open_outputs(const Frame &frame){
+	const std::string base = options_.directory + options_.stem;
+	if (options_.write_video){
+		video_writer_.open(base + ".avi", -1, options_.fps, frame.image.size(), frame.image.channels() == 3);
+		if (video_writer_.isOpened() == false){
+			std::cout << "StreamRecorder: could not open " << base << ".avi" << std::endl;
+		}
+	}
+	if (options_.write_raw_video){
+		raw_writer_.open(base + kRawVideoExtension, frame.image.size(), toPixelFormat(frame.image), options_.fps);
+	}
+}
+
+void StreamRecorder::write_loop(){
+	bool is_opened = false;
+	while (true){
+		Item item;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			queue_cv_.wait(lock, [this]{ return queue_.empty() == false || (is_stopping_ && reserved_ == 0); });
+			if (queue_.empty()) break; // Stopping and drained
+			std::swap(item, queue_.front());
+			queue_.pop_front();
+		}
+		queue_cv_.notify_all(); // Space for a blocked producer
+
+		if (is_opened == false){
+			open_outputs(item.frame);
+			is_opened = true;
+		}
+		if (video_writer_.isOpened()) video_writer_ << item.frame.image;
+		if (raw_writer_.isOpened()) raw_writer_.write(item.frame);
+
+		if (options_.write_images){
+			// Bounded hand-over to the encoders; waiting here backs up into queue_
+			std::unique_lock<std::mutex> lock(mutex_);
+			image_queue_cv_.wait(lock, [this]{ return image_queue_.size() < options_.queue_capacity; });
+			image_queue_.push_back(std::move(item));
+			lock.unlock();
+			image_queue_cv_.notify_all();
+		}
+		else{
+			written_++;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		is_writer_done_ = true;
+	}
+	image_queue_cv_.notify_all();
+}
+
+void StreamRecorder::encode_loop(){
+	std::ostringstream ost_file_name;
+	while (true){
+		Item item;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			image_queue_cv_.wait(lock, [this]{ return image_queue_.empty() == false || is_writer_done_; });
+			if (image_queue_.empty()) break; // Writer finished and everything is encoded
+			std::swap(item, image_queue_.front());
+			image_queue_.pop_front();
+		}
+		image_queue_cv_.notify_all(); // Space for the writer
+
+		ost_file_name.str("");
+		ost_file_name.clear();
+		ost_file_name << options_.directory << options_.stem << "_" << std::setw(6) << std::setfill('0') << item.index << ".png";
+		cv::imwrite(ost_file_name.str(), item.frame.image);
+		written_++;
+	}
+}
+
+} // namespace
@@ -0,0 +1,101 @@
+#ifndef STREAM_RECORDER_H
+#define STREAM_RECORDER_H
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <opencv2/highgui/highgui.hpp>
+#include "frame.h"
+#include "raw_video.h"
+
+namespace eye_tracker
+{
+
+/// What a StreamRecorder writes and how it behaves under load
+struct RecorderOptions {
+	std::string directory = "./tmp/"; ///< Output directory, must exist
+	std::string stem = "cam0";        ///< File stem: <stem>.avi, <stem>.eyeraw, <stem>_000042.png
+	bool write_video = true;          ///< AVI through cv::VideoWriter
+	bool write_raw_video = false;     ///< Raw eye video, see RawVideoWriter
+	bool write_images = false;        ///< One PNG per frame
+	int image_encoder_threads = 2;    ///< Threads encoding PNGs in parallel
+	size_t queue_capacity = 64;       ///< Frames that may wait for the writer
+	bool block_when_full = false;     ///< Block record() instead of dropping the frame when the queue is full
+	double fps = 30;                  ///< Frame rate stored in the video files
+};
+
+/// Counters of a StreamRecorder
+struct RecorderStatistics {
+	size_t submitted = 0;   ///< Frames passed to record()
+	size_t written = 0;     ///< Frames completely written to all outputs
+	size_t dropped = 0;     ///< Frames refused because the queue was full
+	size_t blocked = 0;     ///< record() calls that had to wait for queue space
+	size_t queue_peak = 0;  ///< Highest number of frames waiting in the queue
+	double blocked_ms = 0;  ///< Total time record() spent waiting for queue space
+};
+
+/**
+* @class StreamRecorder
+* @brief Records frames to disk while they are captured.
+*
+* record() copies the frame into a bounded queue and returns immediately; a
+* writer thread appends the frames to the video and raw video files in
+* order, and PNG encoding is spread over its own threads. Session length is
+* only limited by disk space. When the disk cannot keep up, frames are
+* dropped (or record() blocks, see RecorderOptions) and counted.
+*/
+class StreamRecorder
+{
+public:
+	StreamRecorder(const RecorderOptions &options);
+	~StreamRecorder();
+
+	/// Queues a copy of the frame. Call from one thread only. Returns false if the frame was dropped
+	bool record(const Frame &frame);
+	/// Writes all queued frames, closes the files and joins the threads
+	void stop();
+	RecorderStatistics statistics() const;
+
+protected:
+	struct Item {
+		Frame frame;
+		size_t index = 0;
+	};
+
+	void write_loop();
+	void encode_loop();
+	void open_outputs(const Frame &frame);
+
+	const RecorderOptions options_;
+	cv::VideoWriter video_writer_;
+	RawVideoWriter raw_writer_;
+
+	// Frames waiting for the writer thread
+	std::deque<Item> queue_;
+	// Frames waiting for PNG encoding
+	std::deque<Item> image_queue_;
+	mutable std::mutex mutex_;
+	std::condition_variable queue_cv_;       // Signals new frames and free space in queue_
+	std::condition_variable image_queue_cv_; // Signals new frames and free space in image_queue_
+	bool is_stopping_ = false;
+	bool is_writer_done_ = false;
+	size_t next_index_ = 0;
+	size_t reserved_ = 0; // Queue slots of frames being copied by record()
+
+	RecorderStatistics stats_; // Guarded by mutex_
+	std::atomic<size_t> written_;
+
+	std::thread writer_thread_;
+	std::vector<std::thread> encoder_threads_;
+private:
+	// Prevent copying
+	StreamRecorder(const StreamRecorder& other);
+	StreamRecorder& operator=(const StreamRecorder& rhs);
+};
+
+} // namespace
+#endif // STREAM_RECORDER_H
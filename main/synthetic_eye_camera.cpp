@@ -0,0 +1,125 @@
+#include "synthetic_eye_camera.h"
+
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+namespace eye_tracker
+{
+
+namespace sef = singleeyefitter;
+
+namespace {
+// Gray levels of the rendered IR image
+const int kSkinLevel = 150;
+const int kScleraLevel = 185;
+const int kIrisLevel = 95;
+const int kPupilLevel = 20;
+const int kGlintLevel = 250;
+
+cv::RotatedRect toImageRect(const sef::Ellipse2D<double> &ellipse, const cv::Size &size){
+	cv::RotatedRect rect = sef::toRotatedRect(ellipse);
+	rect.center.x += size.width / 2;
+	rect.center.y += size.height / 2;
+	return rect;
+}
+}
+
+EyeCameraSynthetic::EyeCameraSynthetic(const SyntheticEyeOptions &options)
+	: options_(options)
+{
+	pixel_format_ = PixelFormat::Y8;
+	std::cout << "EyeCameraSynthetic: " << options_.size.width << "x" << options_.size.height << ", " << options_.fps << " fps, "
+		<< options_.eye << std::endl;
+}
+
+SyntheticGroundTruth EyeCameraSynthetic::groundTruth(uint64_t sequence) const{
+	const double t = sequence / options_.fps;
+	SyntheticGroundTruth truth;
+	truth.sequence = sequence;
+	truth.theta = CV_PI / 2 + options_.amplitude_theta * std::sin(2 * CV_PI * options_.frequency_theta * t);
+	truth.psi = -CV_PI / 2 + options_.amplitude_psi * std::sin(2 * CV_PI * options_.frequency_psi * t + CV_PI / 3);
+	truth.pupil_circle = sef::circleOnSphere(options_.eye, truth.theta, truth.psi, options_.pupil_radius);
+	truth.gaze = truth.pupil_circle.normal;
+	truth.pupil = sef::Ellipse2D<double>(sef::project(truth.pupil_circle, options_.focal_length));
+	truth.pupil_rect = toImageRect(truth.pupil, options_.size);
+	return truth;
+}
+
+void EyeCameraSynthetic::render(const SyntheticGroundTruth &truth, cv::Mat &image) const{
+	const sef::Sphere<double> &eye = options_.eye;
+	image.create(options_.size, CV_8UC1);
+	image.setTo(cv::Scalar(kSkinLevel));
+
+	// Eyeball, iris (a circle lying on the sphere) and pupil
+	const sef::Ellipse2D<double> eyeball(sef::project(eye, options_.focal_length));
+	cv::ellipse(image, toImageRect(eyeball, options_.size), cv::Scalar(kScleraLevel), -1, CV_AA);
+	const double iris_depth = std::sqrt(eye.radius * eye.radius - options_.iris_radius * options_.iris_radius);
+	const sef::Circle3D<double> iris(eye.centre + iris_depth * truth.gaze, truth.gaze, options_.iris_radius);
+	const sef::Ellipse2D<double> iris_ellipse(sef::project(iris, options_.focal_length));
+	cv::ellipse(image, toImageRect(iris_ellipse, options_.size), cv::Scalar(kIrisLevel), -1, CV_AA);
+	cv::ellipse(image, truth.pupil_rect, cv::Scalar(kPupilLevel), -1, CV_AA);
+
+	// Corneal reflection of an LED next to the camera: the sphere point facing the camera
+	const Eigen::Vector3d glint = eye.centre - eye.radius * eye.centre.normalized();
+	const cv::Point2d glint_px(options_.focal_length * glint.x() / glint.z() + options_.size.width / 2,
+		options_.focal_length * glint.y() / glint.z() + options_.size.height / 2);
+	cv::circle(image, glint_px, 3, cv::Scalar(kGlintLevel), -1, CV_AA);
+
+	// Optics blur and sensor noise, seeded per frame so that every frame is reproducible
+	cv::GaussianBlur(image, image, cv::Size(5, 5), 1.2);
+	if (options_.noise_sigma > 0){
+		cv::Mat noise(options_.size, CV_16SC1);
+		cv::RNG rng(options_.seed * 0x9E3779B97F4A7C15ULL + truth.sequence + 1);
+		rng.fill(noise, cv::RNG::NORMAL, 0, options_.noise_sigma);
+		cv::add(image, noise, image, cv::noArray(), CV_8U);
+	}
+}
+
+void EyeCameraSynthetic::fetchFrame(Frame &frame){
+	const uint64_t sequence = sequence_;
+	if (options_.frame_count > 0 && sequence >= options_.frame_count){
+		frame.image.release(); // End of stream
+		return;
+	}
+	if (options_.is_paced){
+		if (sequence == 0){
+			start_time_ = Clock::now();
+		}
+		std::this_thread::sleep_until(start_time_ + std::chrono::microseconds(static_cast<int64_t>(sequence * 1e6 / options_.fps)));
+	}
+	const SyntheticGroundTruth truth = groundTruth(sequence);
+	if (pixel_format_ == PixelFormat::Y8){
+		render(truth, frame.image);
+	}
+	else{
+		render(truth, grab_buffer_);
+		cv::cvtColor(grab_buffer_, frame.image, CV_GRAY2BGR);
+	}
+	stampFrame(frame);
+}
+
+void TrackingErrorCounter::add(const GazeSample &sample, const cv::RotatedRect &detected, const SyntheticGroundTruth &truth){
+	frames_++;
+	if (sample.is_pupil_found){
+		detected_++;
+		const cv::Point2f d = detected.center - truth.pupil_rect.center;
+		pupil_error_sum_ += std::sqrt(d.x * d.x + d.y * d.y);
+	}
+	if (sample.pupil_circle){
+		const double c = std::max(-1.0, std::min(1.0, sample.pupil_circle.normal.normalized().dot(truth.gaze)));
+		const double error_deg = std::acos(c) * 180.0 / CV_PI;
+		gazes_++;
+		gaze_error_sum_ += error_deg;
+		gaze_error_max_ = std::max(gaze_error_max_, error_deg);
+	}
+}
+
+std::ostream& operator<<(std::ostream &os, const TrackingErrorCounter &errors){
+	return os << "pupil found " << 100.0 * errors.detectionRate() << "% of " << errors.frames() << " frames, 2D centre error="
+		<< errors.meanPupilErrorPx() << " px, gaze error=" << errors.meanGazeErrorDeg() << " deg (max "
+		<< errors.maxGazeErrorDeg() << ", " << errors.gazes() << " gazes)";
+}
+
+} // namespace
@@ -0,0 +1,109 @@
+#ifndef SYNTHETIC_EYE_CAMERA_H
+#define SYNTHETIC_EYE_CAMERA_H
+
+#include <Eigen/Core>
+#include <singleeyefitter/singleeyefitter.h>
+#include <singleeyefitter/projection.h>
+#include <singleeyefitter/Circle.h>
+#include <singleeyefitter/Ellipse.h>
+#include <singleeyefitter/Sphere.h>
+#include <ostream>
+#include "eye_cameras.h"
+#include "eye_model_updater.h"
+
+namespace eye_tracker
+{
+
+/// Eye, camera and gaze trajectory of an EyeCameraSynthetic
+struct SyntheticEyeOptions {
+	cv::Size size = cv::Size(640, 480);
+	double fps = 30;                 ///< Frame rate; the trajectory is sampled at sequence / fps seconds
+	bool is_paced = false;           ///< Deliver frames in real time at fps, otherwise as fast as they are fetched
+	uint64_t frame_count = 0;        ///< Frames before the end of stream, 0 for endless
+	double focal_length = 620;       ///< Pixels
+	singleeyefitter::Sphere<double> eye = singleeyefitter::Sphere<double>(Eigen::Vector3d(0, 0, 45), 12); ///< Camera coordinates, mm
+	double pupil_radius = 2.0;       ///< mm
+	double iris_radius = 6.0;        ///< mm
+	// Lissajous gaze trajectory around the straight view towards the camera (theta = pi/2, psi = -pi/2)
+	double amplitude_theta = 0.35;   ///< Vertical amplitude, rad
+	double amplitude_psi = 0.45;     ///< Horizontal amplitude, rad
+	double frequency_theta = 0.17;   ///< Hz
+	double frequency_psi = 0.25;     ///< Hz
+	double noise_sigma = 4.0;        ///< Gaussian sensor noise, gray levels
+	uint64_t seed = 0;               ///< Noise seed; frames are identical for the same seed and sequence
+};
+
+/// Ground truth of one synthetic frame
+struct SyntheticGroundTruth {
+	uint64_t sequence = 0;
+	double theta = 0, psi = 0;                    ///< Gaze angles on the eye sphere, see singleeyefitter::circleOnSphere
+	singleeyefitter::Circle3D<double> pupil_circle; ///< 3D pupil, camera coordinates (mm); its normal is the gaze
+	singleeyefitter::Ellipse2D<double> pupil;     ///< Projected pupil, image-centred as used by EyeModelUpdater
+	cv::RotatedRect pupil_rect;                   ///< Projected pupil in image coordinates, as PupilDetection::rect
+	Eigen::Vector3d gaze;                         ///< Unit gaze vector
+};
+
+/**
+* @class EyeCameraSynthetic
+* @brief Renders IR-like eye images of a known eye model following a scripted gaze.
+*
+* Frame n shows the eye at time n / fps, so a run is fully deterministic and
+* groundTruth(frame.info.sequence) gives the exact pupil ellipse and gaze of
+* any delivered frame, also behind an EyeCameraThreaded. Images have no lens
+* distortion. Delivers Y8 unless BGR8 is selected.
+*/
+class EyeCameraSynthetic : public EyeCameraParent
+{
+public:
+	EyeCameraSynthetic(const SyntheticEyeOptions &options = SyntheticEyeOptions());
+	~EyeCameraSynthetic() {
+	}
+	bool isOpened() { return true; }
+	void fetchFrame(Frame &frame);
+
+	/// Ground truth of the frame with the given sequence number. Thread-safe
+	SyntheticGroundTruth groundTruth(uint64_t sequence) const;
+	const SyntheticEyeOptions& options() const { return options_; }
+
+protected:
+	void render(const SyntheticGroundTruth &truth, cv::Mat &image) const;
+
+	const SyntheticEyeOptions options_;
+	Clock::time_point start_time_;
+private:
+	// Prevent copying
+	EyeCameraSynthetic(const EyeCameraSynthetic& other);
+	EyeCameraSynthetic& operator=(const EyeCameraSynthetic& rhs);
+};
+
+/**
+* @class TrackingErrorCounter
+* @brief Accumulates the errors of tracking results against synthetic ground truth
+*/
+class TrackingErrorCounter
+{
+public:
+	/// Adds one tracked frame; detected is the 2D pupil in image coordinates
+	void add(const GazeSample &sample, const cv::RotatedRect &detected, const SyntheticGroundTruth &truth);
+	void reset() { *this = TrackingErrorCounter(); }
+
+	size_t frames() const { return frames_; }
+	double detectionRate() const { return frames_ > 0 ? double(detected_) / frames_ : 0; }
+	double meanPupilErrorPx() const { return detected_ > 0 ? pupil_error_sum_ / detected_ : 0; }  ///< 2D pupil centre error
+	double meanGazeErrorDeg() const { return gazes_ > 0 ? gaze_error_sum_ / gazes_ : 0; }          ///< Angle between 3D gaze and truth
+	double maxGazeErrorDeg() const { return gaze_error_max_; }
+	size_t gazes() const { return gazes_; }
+
+protected:
+	size_t frames_ = 0;
+	size_t detected_ = 0;
+	size_t gazes_ = 0;
+	double pupil_error_sum_ = 0;
+	double gaze_error_sum_ = 0;
+	double gaze_error_max_ = 0;
+};
+
+std::ostream& operator<<(std::ostream &os, const TrackingErrorCounter &errors);
+
+} // namespace
+#endif // SYNTHETIC_EYE_CAMERA_H
@@ -0,0 +1,261 @@
+#include "task_scheduler.h"
+
+#include <limits>
+
+namespace eye_tracker
+{
+
+namespace {
+const size_t kNotAWorker = std::numeric_limits<size_t>::max();
+
+// Worker identity of the current thread
+thread_local const TaskScheduler *tls_scheduler = nullptr;
+thread_local size_t tls_worker = kNotAWorker;
+
+std::mutex shared_scheduler_mutex;
+SchedulerOptions shared_scheduler_options;
+std::unique_ptr<TaskScheduler> shared_scheduler;
+}
+
+TaskScheduler::TaskScheduler(const SchedulerOptions &options)
+	: pending_(0), executed_(0), stolen_(0), pinned_(0), realtime_(0)
+{
+	size_t workers = options.workers;
+	if (workers == 0){
+		const size_t cores = std::thread::hardware_concurrency();
+		workers = (cores > 1) ? cores - 1 : 0; // The thread waiting for the work runs tasks too
+	}
+	for (size_t w = 0; w < workers; w++){
+		queues_.push_back(std::make_unique<Worker>());
+	}
+	for (size_t w = 0; w < workers; w++){
+		workers_.emplace_back(&TaskScheduler::worker_loop, this, w);
+		if (options.policy.is_set()){
+			thread_policies_.push_back(apply_thread_policy(workers_.back(), "Worker " + std::to_string(w), options.policy, w));
+			if (thread_policies_.back().is_pinned) pinned_++;
+			if (thread_policies_.back().is_realtime) realtime_++;
+		}
+	}
+}
+
+TaskScheduler::~TaskScheduler(){
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+		is_stopping_ = true;
+	}
+	wake_cv_.notify_all();
+	for (auto &t : workers_){
+		if (t.joinable()) t.join();
+	}
+}
+
+TaskScheduler& TaskScheduler::shared(){
+	std::lock_guard<std::mutex> lock(shared_scheduler_mutex);
+	if (shared_scheduler == nullptr){
+		shared_scheduler = std::make_unique<TaskScheduler>(shared_scheduler_options);
+	}
+	return *shared_scheduler;
+}
+
+bool TaskScheduler::configure(const SchedulerOptions &options){
+	std::lock_guard<std::mutex> lock(shared_scheduler_mutex);
+	if (shared_scheduler != nullptr){
+		return false;
+	}
+	shared_scheduler_options = options;
+	return true;
+}
+
+void TaskScheduler::submit(Task task){
+	if (workers_.empty()){
+		task(); // Nobody else would run it
+		executed_++;
+		return;
+	}
+	if (tls_scheduler == this){
+		Worker &self = *queues_[tls_worker];
+		std::lock_guard<std::mutex> lock(self.mutex);
+		self.tasks.push_back(std::move(task));
+	}
+	else{
+		std::lock_guard<std::mutex> lock(shared_mutex_);
+		shared_tasks_.push_back(std::move(task));
+	}
+	pending_++;
+	notify();
+}
+
+void TaskScheduler::notify(){
+	{ std::lock_guard<std::mutex> lock(sleep_mutex_); }
+	wake_cv_.notify_one();
+}
+
+bool TaskScheduler::take(size_t self, Task &task){
+	if (pending_ == 0){
+		return false;
+	}
+	// Own tasks first, newest first
+	if (self < queues_.size()){
+		Worker &worker = *queues_[self];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (worker.tasks.empty() == false){
+			task = std::move(worker.tasks.back());
+			worker.tasks.pop_back();
+			pending_--;
+			return true;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(shared_mutex_);
+		if (shared_tasks_.empty() == false){
+			task = std::move(shared_tasks_.front());
+			shared_tasks_.pop_front();
+			pending_--;
+			return true;
+		}
+	}
+	// Steal the oldest task of another worker, starting with the next one
+	const size_t n = queues_.size();
+	const size_t first = (self < n) ? self + 1 : 0;
+	for (size_t k = 0; k < n; k++){
+		const size_t victim = (first + k) % n;
+		if (victim == self) continue;
+		Worker &worker = *queues_[victim];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (worker.tasks.empty() == false){
+			task = std::move(worker.tasks.front());
+			worker.tasks.pop_front();
+			pending_--;
+			stolen_++;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool TaskScheduler::run_one(){
+	const size_t self = (tls_scheduler == this) ? tls_worker : kNotAWorker;
+	Task task;
+	if (take(self, task) == false){
+		return false;
+	}
+	try{
+		task();
+	}
+	catch (...){
+		// Tasks that report errors are wrapped by TaskGroup
+	}
+	executed_++;
+	return true;
+}
+
+void TaskScheduler::worker_loop(size_t index){
+	tls_scheduler = this;
+	tls_worker = index;
+	while (true){
+		if (run_one()){
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleep_mutex_);
+		wake_cv_.wait(lock, [this]{ return is_stopping_ || pending_ > 0; });
+		if (is_stopping_ && pending_ == 0) return;
+	}
+}
+
+void TaskScheduler::parallel_for(size_t n, const std::function<void(size_t i)> &body, size_t max_threads){
+	size_t threads = workers_.size() + 1;
+	if (max_threads > 0 && max_threads < threads) threads = max_threads;
+	if (threads > n) threads = n;
+	if (threads <= 1){
+		for (size_t i = 0; i < n; i++){
+			body(i);
+		}
+		return;
+	}
+
+	// Every share takes the next index until none is left, so uneven calls balance themselves
+	std::atomic<size_t> next(0);
+	auto share = [&]() {
+		try{
+			for (size_t i = next++; i < n; i = next++){
+				body(i);
+			}
+		}
+		catch (...){
+			next = n; // Skip the calls not started yet
+			throw;
+		}
+	};
+	TaskGroup group(*this);
+	for (size_t t = 1; t < threads; t++){
+		group.run(share);
+	}
+	std::exception_ptr error;
+	try{
+		share();
+	}
+	catch (...){
+		error = std::current_exception();
+	}
+	group.wait();
+	if (error) std::rethrow_exception(error);
+}
+
+SchedulerStatistics TaskScheduler::statistics() const{
+	SchedulerStatistics stats;
+	stats.workers = workers_.size();
+	stats.executed = executed_;
+	stats.stolen = stolen_;
+	stats.pinned = pinned_;
+	stats.realtime = realtime_;
+	return stats;
+}
+
+
+TaskGroup::TaskGroup(TaskScheduler &scheduler)
+	: scheduler_(scheduler), pending_(0)
+{
+}
+
+TaskGroup::~TaskGroup(){
+	try{
+		wait();
+	}
+	catch (...){
+	}
+}
+
+void TaskGroup::run(TaskScheduler::Task task){
+	pending_++;
+	scheduler_.submit([this, task]() {
+		try{
+			task();
+		}
+		catch (...){
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (error_ == nullptr) error_ = std::current_exception();
+		}
+		// Notify under the lock: wait() cannot return, and the group cannot be destroyed, before it is released
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (--pending_ == 0) done_cv_.notify_all();
+	});
+}
+
+void TaskGroup::wait(){
+	while (pending_ > 0){
+		if (scheduler_.run_one() == false){
+			// The remaining tasks run elsewhere; look for new work now and then
+			std::unique_lock<std::mutex> lock(mutex_);
+			done_cv_.wait_for(lock, std::chrono::milliseconds(1), [this]{ return pending_ == 0; });
+		}
+	}
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		error = error_;
+		error_ = nullptr;
+	}
+	if (error) std::rethrow_exception(error);
+}
+
+} // namespace
@@ -0,0 +1,139 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "thread_policy.h"
+
+namespace eye_tracker
+{
+
+/// Settings of a TaskScheduler
+struct SchedulerOptions {
+	size_t workers = 0;  ///< Worker threads, 0 for one per core minus the thread that submits the work
+	ThreadPolicy policy; ///< Core and priority of the workers; worker i runs on core policy.cores[i % size]
+};
+
+/// Counters of a TaskScheduler
+struct SchedulerStatistics {
+	size_t workers = 0;
+	size_t executed = 0; ///< Tasks run, by workers and by threads waiting for a TaskGroup
+	size_t stolen = 0;   ///< Tasks a worker took from another worker's queue
+	size_t pinned = 0;   ///< Workers whose core affinity could be set
+	size_t realtime = 0; ///< Workers running at the requested priority
+};
+
+/**
+* @class TaskScheduler
+* @brief Work-stealing thread pool shared by all parallel parts of the tracker.
+*
+* Every worker has its own task deque. Tasks submitted by a worker go to the
+* back of its deque and are run from the back (newest first, cache-warm);
+* tasks submitted by other threads go to a shared queue. An idle worker takes
+* from the shared queue, then steals from the front of the other workers'
+* deques, then sleeps. Threads that wait for a TaskGroup run pending tasks
+* meanwhile, so parallel work can nest (recordings > frames > cameras > RANSAC)
+* without adding threads: the whole process uses one set of workers and does
+* not oversubscribe the cores.
+*
+* Tasks should not block on I/O or on each other except through TaskGroup;
+* blocking producers such as camera capture keep their own threads.
+*/
+class TaskScheduler
+{
+public:
+	typedef std::function<void()> Task;
+
+	explicit TaskScheduler(const SchedulerOptions &options = SchedulerOptions());
+	~TaskScheduler();
+
+	/// Scheduler of the process, created on first use
+	static TaskScheduler& shared();
+	/// Sets the options of shared(). Returns false if it was already created
+	static bool configure(const SchedulerOptions &options);
+
+	/// Queues a task. Exceptions thrown by it are lost; use a TaskGroup to get them
+	void submit(Task task);
+	/**
+	Calls body(i) for i = 0..n-1 on the workers and the calling thread and returns when all calls are done.
+	@param max_threads at most this many calls run at the same time, 0 for no limit
+	The first exception thrown by body is rethrown here
+	*/
+	void parallel_for(size_t n, const std::function<void(size_t i)> &body, size_t max_threads = 0);
+	/// Runs one queued task on the calling thread. Returns false if there was none
+	bool run_one();
+
+	size_t workers() const { return workers_.size(); }
+	SchedulerStatistics statistics() const;
+	/// What the thread policy of the options achieved for each worker; empty if none was set
+	const std::vector<ThreadPolicyResult>& thread_policies() const { return thread_policies_; }
+
+protected:
+	struct Worker {
+		std::deque<Task> tasks;
+		std::mutex mutex;
+	};
+
+	void worker_loop(size_t index);
+	bool take(size_t self, Task &task);
+	void notify();
+
+	std::vector<std::unique_ptr<Worker>> queues_;
+	std::deque<Task> shared_tasks_; // Tasks from threads that are not workers
+	std::mutex shared_mutex_;
+	std::atomic<size_t> pending_;   // Queued tasks, all queues
+	std::mutex sleep_mutex_;
+	std::condition_variable wake_cv_;
+	bool is_stopping_ = false;      // Guarded by sleep_mutex_
+	std::atomic<size_t> executed_;
+	std::atomic<size_t> stolen_;
+	size_t pinned_;
+	size_t realtime_;
+	std::vector<ThreadPolicyResult> thread_policies_;
+	std::vector<std::thread> workers_;
+private:
+	// Prevent copying
+	TaskScheduler(const TaskScheduler& other);
+	TaskScheduler& operator=(const TaskScheduler& rhs);
+};
+
+/**
+* @class TaskGroup
+* @brief Tasks that are waited for together.
+*
+* wait() returns once every task of the group is done and rethrows the first
+* exception one of them threw. While waiting, the thread runs queued tasks of
+* the scheduler. The destructor waits too, so tasks may refer to the stack of
+* the thread that created the group.
+*/
+class TaskGroup
+{
+public:
+	explicit TaskGroup(TaskScheduler &scheduler = TaskScheduler::shared());
+	~TaskGroup();
+
+	void run(TaskScheduler::Task task);
+	void wait();
+
+protected:
+	TaskScheduler &scheduler_;
+	std::atomic<size_t> pending_;
+	std::mutex mutex_;
+	std::condition_variable done_cv_;
+	std::exception_ptr error_; // Guarded by mutex_
+private:
+	// Prevent copying
+	TaskGroup(const TaskGroup& other);
+	TaskGroup& operator=(const TaskGroup& rhs);
+};
+
+} // namespace
+#endif // TASK_SCHEDULER_H
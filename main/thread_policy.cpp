@@ -0,0 +1,116 @@
+#include "thread_policy.h"
+
+#include <cstring>
+#include <algorithm>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <cerrno>
+#endif
+
+namespace eye_tracker
+{
+
+namespace {
+#if defined(_WIN32)
+typedef HANDLE ThreadHandle;
+#elif defined(__linux__)
+typedef pthread_t ThreadHandle;
+#else
+typedef int ThreadHandle;
+#endif
+
+void add_error(ThreadPolicyResult &result, const std::string &error){
+	if (result.error.empty() == false) result.error += "; ";
+	result.error += error;
+}
+
+ThreadPolicyResult apply(ThreadHandle thread, const std::string &name, const ThreadPolicy &policy, size_t index){
+	ThreadPolicyResult result;
+	result.name = name;
+	if (policy.cores.empty() == false){
+		result.core = policy.cores[index % policy.cores.size()];
+	}
+	result.priority = policy.priority > 0 ? std::min(policy.priority, 99) : 0;
+
+#if defined(_WIN32)
+	if (result.core >= 0){
+		result.is_pinned = SetThreadAffinityMask(thread, static_cast<DWORD_PTR>(1) << result.core) != 0;
+		if (result.is_pinned == false) add_error(result, "affinity refused");
+	}
+	if (result.priority > 0){
+		// Windows has no per-thread FIFO class; the upper half of the range maps to time critical
+		const int level = (result.priority >= 50) ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+		result.is_realtime = SetThreadPriority(thread, level) != 0;
+		if (result.is_realtime == false) add_error(result, "priority refused");
+	}
+#elif defined(__linux__)
+	if (result.core >= 0){
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(result.core, &set);
+		const int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+		result.is_pinned = (err == 0);
+		if (err != 0) add_error(result, std::string("affinity: ") + std::strerror(err));
+	}
+	if (result.priority > 0){
+		sched_param param;
+		param.sched_priority = std::max(sched_get_priority_min(SCHED_FIFO), std::min(result.priority, sched_get_priority_max(SCHED_FIFO)));
+		const int err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+		result.is_realtime = (err == 0);
+		if (err == EPERM){
+			add_error(result, "SCHED_FIFO not permitted (needs CAP_SYS_NICE or an rtprio limit)");
+		}
+		else if (err != 0){
+			add_error(result, std::string("SCHED_FIFO: ") + std::strerror(err));
+		}
+	}
+#else
+	(void)thread;
+	if (policy.is_set()) add_error(result, "not supported on this platform");
+#endif
+	return result;
+}
+}
+
+ThreadPolicyResult apply_thread_policy(std::thread &thread, const std::string &name, const ThreadPolicy &policy, size_t index){
+#if defined(_WIN32) || defined(__linux__)
+	return apply(thread.native_handle(), name, policy, index);
+#else
+	return apply(0, name, policy, index);
+#endif
+}
+
+ThreadPolicyResult apply_current_thread_policy(const std::string &name, const ThreadPolicy &policy, size_t index){
+#if defined(_WIN32)
+	return apply(GetCurrentThread(), name, policy, index);
+#elif defined(__linux__)
+	return apply(pthread_self(), name, policy, index);
+#else
+	return apply(0, name, policy, index);
+#endif
+}
+
+std::ostream& operator<<(std::ostream &os, const ThreadPolicyResult &result){
+	os << result.name << ": ";
+	if (result.core >= 0){
+		os << "core " << result.core << (result.is_pinned ? "" : " (not pinned)");
+	}
+	else{
+		os << "any core";
+	}
+	if (result.priority > 0){
+		os << ", priority " << result.priority << (result.is_realtime ? " (real-time)" : " (default policy)");
+	}
+	if (result.error.empty() == false){
+		os << " - " << result.error;
+	}
+	return os;
+}
+
+} // namespace
@@ -0,0 +1,45 @@
+#ifndef THREAD_POLICY_H
+#define THREAD_POLICY_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <thread>
+
+namespace eye_tracker
+{
+
+/// Core affinity and scheduling priority of a group of threads
+struct ThreadPolicy {
+	std::vector<int> cores; ///< Thread i of the group runs on core cores[i % cores.size()]; empty to let the OS place it
+	int priority = 0;       ///< Real-time priority 1..99 (SCHED_FIFO on Linux, raised thread priority on Windows); 0 keeps the default policy
+
+	bool is_set() const { return cores.empty() == false || priority > 0; }
+};
+
+/// What apply_thread_policy achieved for one thread
+struct ThreadPolicyResult {
+	std::string name;
+	int core = -1;            ///< Requested core, -1 for none
+	bool is_pinned = false;   ///< The thread is restricted to the core
+	int priority = 0;         ///< Requested priority, 0 for none
+	bool is_realtime = false; ///< The priority was granted
+	std::string error;        ///< Why a request was refused, empty if all were granted
+};
+
+/**
+Pins a thread to its core of the policy and raises its priority. Requests the platform refuses are
+reported in the result instead of thrown: without CAP_SYS_NICE or an RLIMIT_RTPRIO on Linux, SCHED_FIFO
+is not permitted and the thread keeps running under the default policy.
+A SCHED_FIFO thread is only preempted by higher priorities, so it must block (wait on a queue, a
+condition variable or the camera) rather than spin, or it starves everything else on its core.
+@param index position of the thread in its group, selects the core
+*/
+ThreadPolicyResult apply_thread_policy(std::thread &thread, const std::string &name, const ThreadPolicy &policy, size_t index = 0);
+/// Same for the calling thread
+ThreadPolicyResult apply_current_thread_policy(const std::string &name, const ThreadPolicy &policy, size_t index = 0);
+
+std::ostream& operator<<(std::ostream &os, const ThreadPolicyResult &result);
+
+} // namespace
+#endif // THREAD_POLICY_H
@@ -0,0 +1,215 @@
+#include "tracking_server.h"
+
+#include <algorithm>
+#include <iostream>
+#include "batch_processing.h"
+
+namespace eye_tracker
+{
+
+struct TrackingServer::Session {
+	Session(const std::string &name, size_t cameras)
+		: name(name), tracked(cameras), loop_statistics(cameras, 1.0)
+	{
+	}
+	const std::string name;
+	size_t index = 0;
+	std::vector<std::unique_ptr<EyeCameraThreaded>> cameras;
+	std::vector<std::unique_ptr<CameraTracker>> trackers;
+	std::vector<TrackedFrame> tracked; // Reused from tick to tick
+	SessionResultCallback on_result;
+	bool is_ended = false; // Guarded by the server mutex
+
+	mutable std::mutex stats_mutex;
+	LoopStatistics loop_statistics;
+	size_t ticks = 0;
+	double busy_ms = 0;
+};
+
+std::unique_ptr<EyeCameraParent> open_source(const std::string &spec, bool &is_live){
+	is_live = true;
+	if (spec.compare(0, 4, "cam:") == 0){
+		return std::make_unique<EyeCamera>(std::stoi(spec.substr(4)), false);
+	}
+	if (spec.compare(0, 3, "ds:") == 0){
+		return std::make_unique<EyeCameraDS>(spec.substr(3));
+	}
+	is_live = false;
+	return open_recording(spec);
+}
+
+TrackingServer::TrackingServer(size_t threads, TaskScheduler &scheduler)
+	: scheduler_(scheduler), threads_count_(threads > 0 ? threads : std::max<size_t>(1, scheduler.workers()))
+{
+	if (scheduler_.workers() == 0){
+		// Ticks are dispatched from the capture threads, which must not track themselves
+		throw "TrackingServer: the scheduler has no worker threads";
+	}
+}
+
+TrackingServer::~TrackingServer(){
+	stop();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		idle_.clear();
+	}
+	// Stop the capture threads while the server is still whole; their callbacks see is_stopping_
+	sessions_.clear();
+}
+
+size_t TrackingServer::addSession(const std::string &name, std::vector<std::unique_ptr<EyeCameraParent>> sources, bool is_live,
+	std::vector<std::unique_ptr<CameraTracker>> trackers, SessionResultCallback on_result){
+	if (is_started_){
+		throw "TrackingServer: sessions must be added before start()";
+	}
+	if (sources.size() != trackers.size() || sources.empty()){
+		throw "TrackingServer: a session needs one tracker per source";
+	}
+	std::unique_ptr<Session> session = std::make_unique<Session>(name, sources.size());
+	session->index = sessions_.size();
+	const FramePolicy policy = is_live ? FramePolicy::LATEST_FRAME : FramePolicy::EVERY_FRAME;
+	for (size_t cam = 0; cam < sources.size(); cam++){
+		sources[cam]->setSourceId(static_cast<int>(cam));
+		session->cameras.push_back(std::make_unique<EyeCameraThreaded>(std::move(sources[cam]), policy, 8, is_live));
+		session->cameras.back()->setFrameCallback([this]() { dispatch(); });
+	}
+	session->trackers = std::move(trackers);
+	session->on_result = on_result;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		idle_.push_back(session.get());
+	}
+	sessions_.push_back(std::move(session));
+	return sessions_.back()->index;
+}
+
+void TrackingServer::start(){
+	std::cout << "TrackingServer: " << sessions_.size() << " sessions, " << threads_count_ << " at a time on "
+		<< scheduler_.workers() << " scheduler threads" << std::endl;
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (is_started_) return;
+	is_started_ = true;
+	dispatch_locked();
+}
+
+bool TrackingServer::waitFor(double seconds){
+	std::unique_lock<std::mutex> lock(mutex_);
+	return tick_cv_.wait_for(lock, std::chrono::duration<double>(seconds), [this]{ return ended_ == sessions_.size(); });
+}
+
+void TrackingServer::stop(){
+	std::unique_lock<std::mutex> lock(mutex_);
+	is_stopping_ = true;
+	tick_cv_.wait(lock, [this]{ return running_ == 0; });
+}
+
+void TrackingServer::dispatch(){
+	std::lock_guard<std::mutex> lock(mutex_);
+	dispatch_locked();
+}
+
+void TrackingServer::dispatch_locked(){
+	if (is_started_ == false || is_stopping_) return;
+	while (running_ < threads_count_){
+		Session *session = take_ready_session();
+		if (session == nullptr) return;
+		running_++;
+		// The scheduler has workers, so submit() only queues the tick and may be called under the lock
+		scheduler_.submit([this, session]() { run_tick(*session); });
+	}
+}
+
+TrackingServer::Session* TrackingServer::take_ready_session(){
+	for (auto it = idle_.begin(); it != idle_.end(); ++it){
+		bool is_ready = true;
+		for (const auto &camera : (*it)->cameras){
+			is_ready = is_ready && camera->isFrameReady();
+		}
+		if (is_ready){
+			Session *session = *it;
+			idle_.erase(it);
+			return session;
+		}
+	}
+	return nullptr;
+}
+
+void TrackingServer::run_tick(Session &session){
+	const bool is_running = track_tick(session);
+	// The server is not touched after the lock is released: stop() may return then
+	std::lock_guard<std::mutex> lock(mutex_);
+	running_--;
+	if (is_running){
+		idle_.push_back(&session); // Back of the queue: the other ready sessions go first
+	}
+	else{
+		session.is_ended = true;
+		ended_++;
+	}
+	// Sessions whose frames arrived while all slots were busy
+	dispatch_locked();
+	tick_cv_.notify_all();
+}
+
+bool TrackingServer::track_tick(Session &session){
+	const Clock::time_point start = Clock::now();
+	try{
+		for (size_t cam = 0; cam < session.cameras.size(); cam++){
+			session.cameras[cam]->fetchFrame(session.tracked[cam].frame);
+			if (session.tracked[cam].frame.empty()){
+				std::cout << "TrackingServer: " << session.name << " ended" << std::endl;
+				return false;
+			}
+		}
+		for (size_t cam = 0; cam < session.cameras.size(); cam++){
+			session.trackers[cam]->process(session.tracked[cam]);
+		}
+		if (session.on_result){
+			session.on_result(session.index, session.tracked);
+		}
+	}
+	catch (const char *c){
+		std::cout << "TrackingServer: " << session.name << ": " << c << std::endl;
+		return false;
+	}
+	catch (const std::exception &e){
+		std::cout << "TrackingServer: " << session.name << ": " << e.what() << std::endl;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(session.stats_mutex);
+	for (size_t cam = 0; cam < session.tracked.size(); cam++){
+		session.loop_statistics.add(cam, session.tracked[cam].sample);
+	}
+	session.loop_statistics.update();
+	session.ticks++;
+	session.busy_ms += millisecondsSince(start);
+	return true;
+}
+
+std::vector<SessionStatistics> TrackingServer::statistics() const{
+	std::vector<SessionStatistics> stats(sessions_.size());
+	for (size_t s = 0; s < sessions_.size(); s++){
+		const Session &session = *sessions_[s];
+		stats[s].name = session.name;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stats[s].is_ended = session.is_ended;
+		}
+		std::lock_guard<std::mutex> lock(session.stats_mutex);
+		stats[s].ticks = session.ticks;
+		stats[s].busy_ms = session.busy_ms;
+		stats[s].cameras = session.loop_statistics.last();
+	}
+	return stats;
+}
+
+std::ostream& operator<<(std::ostream &os, const SessionStatistics &stats){
+	os << stats.name << (stats.is_ended ? " (ended)" : "") << ": ticks=" << stats.ticks << ", busy=" << stats.busy_ms << " ms";
+	for (size_t cam = 0; cam < stats.cameras.size(); cam++){
+		os << "\n    Cam" << cam << ": " << stats.cameras[cam];
+	}
+	return os;
+}
+
+} // namespace
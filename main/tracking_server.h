@@ -0,0 +1,111 @@
+#ifndef TRACKING_SERVER_H
+#define TRACKING_SERVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <ostream>
+#include <mutex>
+#include <condition_variable>
+#include "eye_cameras.h"
+#include "camera_tracker.h"
+#include "loop_statistics.h"
+#include "task_scheduler.h"
+
+namespace eye_tracker
+{
+
+/// Receives the tracked frames of one capture tick of a session, one per camera. Runs on a worker thread
+typedef std::function<void(size_t session, const std::vector<TrackedFrame> &tracked)> SessionResultCallback;
+
+/// Counters of one session of a TrackingServer
+struct SessionStatistics {
+	std::string name;
+	bool is_ended = false;
+	size_t ticks = 0;                        ///< Capture ticks tracked
+	double busy_ms = 0;                      ///< Worker time spent on the session
+	std::vector<IntervalStatistics> cameras; ///< Frame counts and latency of each camera over the last second
+};
+
+std::ostream& operator<<(std::ostream &os, const SessionStatistics &stats);
+
+/**
+Opens a camera of a headset: "cam:<index>" for an OpenCV camera, "ds:<name>" for a
+DirectShow camera, or a recording as accepted by open_recording().
+@param is_live set to true for cameras, false for recordings
+*/
+std::unique_ptr<EyeCameraParent> open_source(const std::string &spec, bool &is_live);
+
+/**
+* @class TrackingServer
+* @brief Tracks many headsets in one process on the shared TaskScheduler.
+*
+* Each session (headset) has its own cameras, trackers, eye models and detector
+* state. A session is the unit of scheduling: once every camera of a session has
+* a frame, one tick of it (fetch and track the frames of all its cameras) is
+* submitted as a task, and the session then goes to the back of the queue.
+* The ready session that has waited longest always goes first, so every session
+* gets one tick per round however fast its cameras are, and a session is never
+* tracked twice at once. Ticks are dispatched when a capture thread publishes a
+* frame, so N headsets need about as many cores as their tracking work, not N
+* processes.
+*/
+class TrackingServer
+{
+public:
+	/**
+	@param threads sessions tracked at the same time, 0 for one per worker of the scheduler
+	@param scheduler runs the ticks; it needs at least one worker thread
+	*/
+	explicit TrackingServer(size_t threads = 0, TaskScheduler &scheduler = TaskScheduler::shared());
+	~TrackingServer();
+
+	/**
+	Adds a headset. Only allowed before start().
+	@param sources image sources of the headset; each one is moved behind its own capture thread
+	@param is_live live sources track the newest frame, recordings every frame
+	@param trackers one per source
+	@param on_result optional consumer of the results
+	@return index of the session
+	*/
+	size_t addSession(const std::string &name, std::vector<std::unique_ptr<EyeCameraParent>> sources, bool is_live,
+		std::vector<std::unique_ptr<CameraTracker>> trackers, SessionResultCallback on_result = nullptr);
+
+	void start();
+	/// Waits until every session has ended, at most seconds. Returns true if they all ended
+	bool waitFor(double seconds);
+	void stop();
+
+	std::vector<SessionStatistics> statistics() const;
+	size_t threads() const { return threads_count_; }
+	size_t sessions() const { return sessions_.size(); }
+
+protected:
+	struct Session;
+
+	void dispatch();
+	void dispatch_locked();
+	Session* take_ready_session();
+	void run_tick(Session &session);
+	bool track_tick(Session &session);
+
+	TaskScheduler &scheduler_;
+	const size_t threads_count_;
+	std::vector<std::unique_ptr<Session>> sessions_;
+	std::deque<Session*> idle_; // Sessions not being tracked, oldest first
+	size_t running_ = 0;        // Ticks submitted and not finished
+	size_t ended_ = 0;
+	bool is_started_ = false;
+	bool is_stopping_ = false;
+	mutable std::mutex mutex_;
+	std::condition_variable tick_cv_; // A tick finished
+private:
+	// Prevent copying
+	TrackingServer(const TrackingServer& other);
+	TrackingServer& operator=(const TrackingServer& rhs);
+};
+
+} // namespace
+#endif // TRACKING_SERVER_H
@@ -707,14 +707,6 @@ Jet ellipseGoodness(const Ellipse2D<Jet>& ellipse, const cv::Mat_<uint8_t>& eye,
 }
 }
 
-template<typename T>
-Eigen::Matrix<T,3,1> sph2cart(T r, T theta, T psi) {
-    using std::sin;
-    using std::cos;
-
-    return r * Eigen::Matrix<T,3,1>(sin(theta)*cos(psi), cos(theta), sin(theta)*sin(psi));
-}
-
 template<typename T>
 T angleDiffGoodness(T theta1, T psi1, T theta2, T psi2, typename ad_traits<T>::scalar sigma) {
     using std::sin;
@@ -733,16 +725,6 @@ T angleDiffGoodness(T theta1, T psi1, T theta2, T psi2, typename ad_traits<T>::s
     return exp(-sq(dist)/sq(sigma));
 }
 
-template<typename T>
-Circle3D<T> circleOnSphere(const Sphere<T>& sphere, T theta, T psi, T circle_radius) {
-    typedef Eigen::Matrix<T,3,1> Vector3;
-
-    Vector3 radial = sph2cart<T>(T(1), theta, psi);
-    return Circle3D<T>(sphere.centre + sphere.radius * radial,
-        radial,
-        circle_radius);
-}
-
 template<typename T>
 struct EllipseGoodnessFunction {
     T operator()(const Sphere<T>& eye, T theta, T psi, T pupil_radius, T focal_length, typename ad_traits<T>::scalar band_width, typename ad_traits<T>::scalar step_epsilon, const cv::Mat& mEye) {
@@ -1252,7 +1234,7 @@ const singleeyefitter::EyeModelFitter::Circle& singleeyefitter::EyeModelFitter::
     return refine_single_with_contrast(pupils[id]);
 }
 
-const singleeyefitter::EyeModelFitter::Circle& singleeyefitter::EyeModelFitter::initialise_single_observation(Pupil& pupil)
+const singleeyefitter::EyeModelFitter::Circle& singleeyefitter::EyeModelFitter::initialise_single_observation(Pupil& pupil) const
 {
     // Ignore the pupil circle normal, and intersect the pupil circle
     // centre projection line with the eyeball sphere
@@ -1685,13 +1667,22 @@ void singleeyefitter::EyeModelFitter::unproject_observations(double pupil_radius
         };
         auto error = m_error;
 
-        auto best_inlier_indices = decltype(indices)();
-        Vector2 best_eye_centre_proj;// = nearest_intersect(pupil_gazelines_proj);
-        double best_line_distance_error = std::numeric_limits<double>::infinity();// = fun::sum(LAMBDA(const Line& line)(error(best_eye_centre_proj,line)), pupil_gazelines_proj);
-
+        // Draw all samples up front, so that the random sequence, and with it the result, does not
+        // depend on how the hypotheses are spread over threads; then score the hypotheses in parallel
+        std::vector<decltype(indices)> index_samples(k);
         for (int i = 0; i < k; ++i) {
-            auto index_sample = singleeyefitter::randomSubset(indices, n);
-            auto sample = fun::map([&](size_t i){ return pupil_gazelines_proj[i]; }, index_sample);
+            index_samples[i] = singleeyefitter::randomSubset(indices, n);
+        }
+
+        struct Hypothesis {
+            bool valid = false;
+            Eigen::Matrix<double, 2, 1, Eigen::DontAlign> centre_proj;
+            double line_distance_error = std::numeric_limits<double>::infinity();
+            decltype(indices) inlier_indices;
+        };
+        std::vector<Hypothesis> hypotheses(k);
+        auto score_hypothesis = [&](size_t i) {
+            auto sample = fun::map([&](size_t i){ return pupil_gazelines_proj[i]; }, index_samples[i]);
 
             auto sample_centre_proj = nearest_intersect(sample);
 
@@ -1701,19 +1692,38 @@ void singleeyefitter::EyeModelFitter::unproject_observations(double pupil_radius
             auto inliers = fun::map([&](size_t i){ return pupil_gazelines_proj[i]; }, index_inliers);
 
             if (inliers.size() <= w*pupil_gazelines_proj.size()) {
-                continue;
+                return;
             }
 
-            auto inlier_centre_proj = nearest_intersect(inliers);
+            Vector2 inlier_centre_proj = nearest_intersect(inliers);
 
-            double line_distance_error = fun::sum(
+            Hypothesis& hypothesis = hypotheses[i];
+            hypothesis.centre_proj = inlier_centre_proj;
+            hypothesis.line_distance_error = fun::sum(
                 [&](size_t i){ return error(inlier_centre_proj, pupil_gazelines_proj[i]); },
                 indices);
+            hypothesis.inlier_indices = std::move(index_inliers);
+            hypothesis.valid = true;
+        };
+        if (parallel_for) {
+            parallel_for(hypotheses.size(), score_hypothesis);
+        }
+        else {
+            for (size_t i = 0; i < hypotheses.size(); ++i) {
+                score_hypothesis(i);
+            }
+        }
+
+        // Pick the best one in sample order, as the sequential search did
+        auto best_inlier_indices = decltype(indices)();
+        Vector2 best_eye_centre_proj;// = nearest_intersect(pupil_gazelines_proj);
+        double best_line_distance_error = std::numeric_limits<double>::infinity();// = fun::sum(LAMBDA(const Line& line)(error(best_eye_centre_proj,line)), pupil_gazelines_proj);
 
-            if (line_distance_error < best_line_distance_error) {
-                best_eye_centre_proj = inlier_centre_proj;
-                best_line_distance_error = line_distance_error;
-                best_inlier_indices = std::move(index_inliers);
+        for (auto& hypothesis : hypotheses) {
+            if (hypothesis.valid && hypothesis.line_distance_error < best_line_distance_error) {
+                best_eye_centre_proj = hypothesis.centre_proj;
+                best_line_distance_error = hypothesis.line_distance_error;
+                best_inlier_indices = std::move(hypothesis.inlier_indices);
             }
         }
 
@@ -1,7 +1,9 @@
 #ifndef _SPHERE_H_
 #define _SPHERE_H_
 
+#include <cmath>
 #include <Eigen/Core>
+#include <singleeyefitter/Circle.h>
 
 namespace singleeyefitter {
 
@@ -54,6 +56,27 @@ namespace singleeyefitter {
             "radius: " << circle.radius << " }";
     }
 
+    // Unit vector for the spherical angles used by the eye model: theta from the
+    // y axis, psi in the x-z plane (psi = -pi/2 points towards the camera)
+    template<typename T>
+    Eigen::Matrix<T,3,1> sph2cart(T r, T theta, T psi) {
+        using std::sin;
+        using std::cos;
+
+        return r * Eigen::Matrix<T,3,1>(sin(theta)*cos(psi), cos(theta), sin(theta)*sin(psi));
+    }
+
+    // Circle of the given radius on the surface of a sphere, facing outwards at (theta, psi)
+    template<typename T>
+    Circle3D<T> circleOnSphere(const Sphere<T>& sphere, T theta, T psi, T circle_radius) {
+        typedef Eigen::Matrix<T,3,1> Vector3;
+
+        Vector3 radial = sph2cart<T>(T(1), theta, psi);
+        return Circle3D<T>(sphere.centre + sphere.radius * radial,
+            radial,
+            circle_radius);
+    }
+
 }
 
 /*namespace matlab {
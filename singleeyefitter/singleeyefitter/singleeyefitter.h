@@ -2,6 +2,7 @@
 #define SingleEyeFitter_h__
 
 #include <mutex>
+#include <functional>
 #include <Eigen/Core>
 #include <opencv2/core/core.hpp>
 #include <singleeyefitter/cvx.h>
@@ -62,6 +63,11 @@ namespace singleeyefitter {
         double region_step_epsilon;
         double region_scale;
 
+        // Runs body(i) for i = 0..n-1, possibly in parallel, and returns when all calls are done.
+        // Used for the RANSAC hypotheses of unproject_observations(); empty for a plain loop
+        typedef std::function<void(size_t n, const std::function<void(size_t i)>& body)> ParallelFor;
+        ParallelFor parallel_for;
+
         // Constructors
         EyeModelFitter();
         EyeModelFitter(double focal_length, double region_band_width, double region_step_epsilon);
@@ -126,7 +132,7 @@ namespace singleeyefitter {
         int model_version = 0;
 
         const Circle& unproject_single_observation(Pupil& pupil, double pupil_radius = 1) const;
-        const Circle& initialise_single_observation(Pupil& pupil);
+        const Circle& initialise_single_observation(Pupil& pupil) const;
         const Circle& refine_single_with_contrast(Pupil& pupil);
         double single_contrast_metric(const Pupil& pupil) const;
         void print_single_contrast_metric(const Pupil& pupil) const;